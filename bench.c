@@ -0,0 +1,368 @@
+/* See LICENSE for license details. */
+/*
+ * Headless throughput benchmark for the terminal emulation. st.c is linked
+ * against a stub window backend and byte streams are replayed through
+ * twrite() in the same chunks as ttyread() would see them.
+ *
+ * usage: stbench [-c cols] [-r rows] [-n rounds] [-s size] [file ...]
+ *
+ * Without files the built-in corpora are generated and replayed. Files
+ * can be recorded with e.g. script(1) and are replayed as they are.
+ */
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wchar.h>
+
+char *argv0;
+#include "arg.h"
+#include "st.h"
+#include "win.h"
+#include "patch/scrollback.h"
+
+#define CHUNKSIZ	(64*1024)
+
+typedef struct {
+	char *buf;
+	size_t len, siz;
+} Corpus;
+
+typedef struct {
+	const char *name;
+	void (*gen)(Corpus *, unsigned int);
+} Generator;
+
+static void append(Corpus *, const char *, size_t);
+static void appendf(Corpus *, const char *, ...);
+static void genascii(Corpus *, unsigned int);
+static void gensgr(Corpus *, unsigned int);
+static void gentruecolor(Corpus *, unsigned int);
+static void gencjk(Corpus *, unsigned int);
+static void genscroll(Corpus *, unsigned int);
+static void gensixel(Corpus *, unsigned int);
+static void readcorpus(Corpus *, const char *);
+static void replay(const char *, const Corpus *);
+static void usage(void);
+
+static const Generator generators[] = {
+	{ "ascii",     genascii },
+	{ "sgr",       gensgr },
+	{ "truecolor", gentruecolor },
+	{ "cjk",       gencjk },
+	{ "scroll",    genscroll },
+	{ "sixel",     gensixel },
+};
+
+static const char *words[] = {
+	"the", "quick", "brown", "fox", "jumps", "over", "lazy", "dog",
+	"int", "return", "static", "void", "{", "}", "(char *)", "0x7f",
+	"/usr/lib/x86_64-linux-gnu/libc.so.6", "make[2]:", "-Wall", "st.c",
+};
+
+static int cols = 80, rows = 24, rounds = 5;
+static size_t corpussiz = 8*1024*1024;
+static unsigned int seed = 1;
+
+/* stub window backend */
+Term term;
+DC dc;
+XWindow xw;
+XSelection xsel;
+TermWindow win;
+
+/* the configuration used by st.c, generated from config.h */
+#include "benchconfig.h"
+const char *env_exe_path = NULL;
+
+void xbell(void) {}
+void xclipcopy(void) {}
+void xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Line line) {}
+void xdrawline(Line line, int x1, int y1, int x2) {}
+void xflushlines(void) {}
+int xscroll(int top, int bot, int n) { return 1; }
+void xfinishdraw(void) {}
+int xsetcolorname(int x, const char *name) { return 0; }
+void xseticontitle(char *p) {}
+void xfreetitlestack(void) {}
+void xsettitle(char *p, int pop) {}
+void xpushtitle(void) {}
+int xsetcursor(int cursor) { return 0; }
+void xsetmode(int set, unsigned int flags) {}
+void xsetpointermotion(int set) {}
+void xsetsel(char *str) { free(str); }
+int xstartdraw(void) { return 1; }
+void xximspot(int x, int y) {}
+void xdrawglyph(Glyph *g, int x, int y) {}
+
+int
+xgetcolor(int x, unsigned char *r, unsigned char *g, unsigned char *b)
+{
+	*r = *g = *b = 0;
+	return 0;
+}
+
+void
+xloadcols(void)
+{
+	if (dc.col)
+		return;
+	dc.collen = MAX(MAX(defaultfg, defaultbg), defaultcs) + 1;
+	dc.col = xmalloc(dc.collen * sizeof(Color));
+	memset(dc.col, 0, dc.collen * sizeof(Color));
+}
+
+/* box drawing glyphs are not detected, the tables live in x.c */
+int isboxdraw(Rune u) { return 0; }
+
+void clearurl(int clearhyperlinkhint) {}
+void drawhyperlinkhint(void) {}
+char *detecturl(int col, int row, int draw) { return NULL; }
+void openUrlOnClick(int col, int row, char *url_opener) {}
+void copyUrlOnClick(int col, int row) {}
+
+static unsigned int
+rnd(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+void
+append(Corpus *c, const char *s, size_t n)
+{
+	if (c->len + n > c->siz) {
+		c->siz = MAX(c->siz * 2, c->len + n);
+		c->buf = xrealloc(c->buf, c->siz);
+	}
+	memcpy(c->buf + c->len, s, n);
+	c->len += n;
+}
+
+void
+appendf(Corpus *c, const char *fmt, ...)
+{
+	char s[256];
+	va_list ap;
+	int n;
+
+	va_start(ap, fmt);
+	n = vsnprintf(s, sizeof(s), fmt, ap);
+	va_end(ap);
+	append(c, s, MIN(n, sizeof(s) - 1));
+}
+
+/* plain text lines like the output of a compiler or cat */
+void
+genascii(Corpus *c, unsigned int n)
+{
+	int i, len;
+
+	while (n--) {
+		for (len = 0, i = rnd() % 24; i > 0; i--) {
+			appendf(c, "%s ", words[rnd() % LEN(words)]);
+			if ((len += 8) > cols * 2)
+				break;
+		}
+		append(c, "\r\n", 2);
+	}
+}
+
+/* short colored words like ls --color or a syntax highlighter */
+void
+gensgr(Corpus *c, unsigned int n)
+{
+	static const char *sgr[] = {
+		"1", "0", "3", "4", "7", "31", "32", "1;34", "38;5;208", "48;5;17",
+		"4:3", "58;5;196", "39;49", "22;23;24",
+	};
+	int i;
+
+	while (n--) {
+		for (i = rnd() % 12; i > 0; i--) {
+			appendf(c, "\033[%sm%s\033[0m ", sgr[rnd() % LEN(sgr)],
+			        words[rnd() % LEN(words)]);
+		}
+		append(c, "\r\n", 2);
+	}
+}
+
+/* a 24-bit color gradient with a new color for every cell */
+void
+gentruecolor(Corpus *c, unsigned int n)
+{
+	int x;
+
+	while (n--) {
+		for (x = 0; x < cols; x++) {
+			appendf(c, "\033[38;2;%d;%d;%dm\033[48;2;%d;%d;%dm%c",
+			        x * 3 & 0xff, n & 0xff, 255 - (x & 0xff),
+			        n * 7 & 0xff, x & 0xff, 128, 'A' + x % 26);
+		}
+		append(c, "\033[0m\r\n", 6);
+	}
+}
+
+/* double width characters */
+void
+gencjk(Corpus *c, unsigned int n)
+{
+	char s[4];
+	int i;
+
+	while (n--) {
+		for (i = rnd() % cols; i > 0; i--)
+			append(c, s, utf8encode(0x4e00 + rnd() % 0x5000, s));
+		append(c, "\r\n", 2);
+	}
+}
+
+/* a status line and a scrolling region like in a pager or an editor */
+void
+genscroll(Corpus *c, unsigned int n)
+{
+	appendf(c, "\033[2;%dr", rows - 1);
+	while (n--) {
+		appendf(c, "\0337\033[1;1H\033[7mline %u\033[K\033[0m\0338", n);
+		if (n % 8) {
+			appendf(c, "\033[%d;1H\n%s %s", rows - 1,
+			        words[rnd() % LEN(words)], words[rnd() % LEN(words)]);
+		} else {
+			appendf(c, "\033[2;1H\033M\033[2L\033[3;1H\033[M");
+		}
+	}
+	append(c, "\033[r", 3);
+}
+
+/* small sixel images, every pixel column painted with several colors */
+void
+gensixel(Corpus *c, unsigned int n)
+{
+	int i, x, y;
+
+	while (n--) {
+		appendf(c, "\033Pq\"1;1;64;24");
+		for (i = 0; i < 4; i++)
+			appendf(c, "#%d;2;%d;%d;%d", i, rnd() % 101, rnd() % 101, rnd() % 101);
+		for (y = 0; y < 4; y++) {
+			for (i = 0; i < 4; i++) {
+				appendf(c, "#%d", i);
+				for (x = 0; x < 64; x++)
+					append(c, &(char){ 0x3f + (rnd() & 0x3f) }, 1);
+				append(c, "$", 1);
+			}
+			append(c, "-", 1);
+		}
+		append(c, "\033\\\r\n", 4);
+	}
+}
+
+void
+readcorpus(Corpus *c, const char *path)
+{
+	char buf[BUFSIZ];
+	size_t n;
+	FILE *fp;
+
+	if (!(fp = fopen(path, "r")))
+		die("open %s: %s\n", path, strerror(errno));
+	while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+		append(c, buf, n);
+	if (ferror(fp))
+		die("read %s: %s\n", path, strerror(errno));
+	fclose(fp);
+}
+
+void
+replay(const char *name, const Corpus *c)
+{
+	struct timespec start, end;
+	size_t off, total = 0;
+	int i, n;
+	double ms;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < rounds; i++) {
+		/* reset the terminal */
+		twrite("\033c", 2, 0);
+		for (off = 0; off < c->len; off += n) {
+			/* an incomplete sequence is carried over like in ttyread() */
+			if ((n = twrite(c->buf + off, MIN(CHUNKSIZ, c->len - off), 0)) == 0)
+				break;
+		}
+		total += c->len;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	ms = TIMEDIFF(end, start);
+	printf("%-12s %10zu bytes %9.1f MB/s %8.2f ns/byte\n", name, c->len,
+	       total / (ms * 1E3), ms * 1E6 / total);
+}
+
+void
+usage(void)
+{
+	die("usage: %s [-c cols] [-r rows] [-n rounds] [-s size] [file ...]\n",
+	    argv0);
+}
+
+int
+main(int argc, char *argv[])
+{
+	Corpus c = {0};
+	int i;
+
+	ARGBEGIN {
+	case 'c':
+		cols = atoi(EARGF(usage()));
+		break;
+	case 'r':
+		rows = atoi(EARGF(usage()));
+		break;
+	case 'n':
+		rounds = atoi(EARGF(usage()));
+		break;
+	case 's':
+		corpussiz = strtoul(EARGF(usage()), NULL, 10) * 1024;
+		break;
+	default:
+		usage();
+	} ARGEND;
+
+	if (cols < 2 || rows < 3 || rounds < 1 || corpussiz == 0)
+		usage();
+
+	win.cw = 8;
+	win.ch = 16;
+	win.tw = cols * win.cw;
+	win.th = rows * win.ch;
+	term.hyperlinks = xmalloc(sizeof(Hyperlinks));
+	term.hyperlinks_alt = xmalloc(sizeof(Hyperlinks));
+	memset(term.hyperlinks, 0, sizeof(Hyperlinks));
+	memset(term.hyperlinks_alt, 0, sizeof(Hyperlinks));
+	xloadcols();
+	sethistorylimit(2000);
+	tnew(cols, rows);
+	selinit();
+
+	if (argc > 0) {
+		for (i = 0; i < argc; i++) {
+			c.len = 0;
+			readcorpus(&c, argv[i]);
+			replay(argv[i], &c);
+		}
+	} else {
+		for (i = 0; i < LEN(generators); i++) {
+			c.len = 0;
+			seed = 1;
+			while (c.len < corpussiz)
+				generators[i].gen(&c, 256);
+			replay(generators[i].name, &c);
+		}
+	}
+	free(c.buf);
+
+	return 0;
+}
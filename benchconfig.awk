@@ -0,0 +1,60 @@
+# Generates benchconfig.h, the configuration that st.c uses, for stbench:
+#
+#	awk -f benchconfig.awk st.h config.h > benchconfig.h
+#
+# The variables declared extern in st.h are copied from config.h with the
+# macros of config.h, so that stbench runs with the same settings as st.
+# The rest of config.h needs the X side of st and is left out.
+
+# the names of the extern variables
+NR == FNR && /^extern / {
+	s = $0
+	sub(/^extern[ \t]+/, "", s)
+	sub(/;.*/, "", s)
+	n = split(s, decl, ",")
+	for (i = 1; i <= n; i++) {
+		name = decl[i]
+		sub(/\[.*/, "", name)
+		gsub(/.*[ \t*]/, "", name)
+		names[name] = 1
+	}
+	next
+}
+
+NR == FNR {
+	next
+}
+
+# the continued lines of a macro or a definition
+copy {
+	print
+	copy = define ? /\\$/ : !ended($0)
+	next
+}
+
+/^#[ \t]*define/ {
+	print
+	define = 1
+	copy = /\\$/
+	next
+}
+
+/^[A-Za-z_]/ && !/^(static|typedef|struct|enum|union)[ \t]/ && /=/ {
+	s = $0
+	sub(/[ \t]*=.*/, "", s)
+	sub(/\[.*/, "", s)
+	gsub(/.*[ \t*]/, "", s)
+	if (s in names) {
+		print
+		define = 0
+		copy = !ended($0)
+	}
+}
+
+# whether the definition ends on the line
+function ended(line)
+{
+	sub(/\/\*.*\*\//, "", line)
+	sub(/\/\/.*/, "", line)
+	return line ~ /;[ \t]*$/
+}
@@ -146,6 +146,27 @@ static float maxlatency = 33;
  */
 static unsigned int su_timeout = 200;
 
+/*
+ * time in ms the window size must stay unchanged before the scrollback is
+ * reflowed after a resize. Until then only the screen is reflowed. Set to 0
+ * to reflow the scrollback on every resize.
+ */
+static unsigned int reflowtimeout = 100;
+
+/*
+ * file the frame stats are appended to when st receives SIGUSR2. The stats
+ * are written to stderr if it is NULL. The stats of the last frame can be
+ * shown on the screen with togglestats.
+ */
+static char *statsfile = NULL;
+
+/*
+ * memory in KiB for the rendered glyphs of each font. Xft drops glyphs
+ * when a font has used it up, so raise it for large fonts or emoji. 0 uses
+ * the default of Xft, which is 1024.
+ */
+static int glyphcachesize = 0;
+
 /*
  * Specifies how fast the screen scrolls when you select text and drag the
  * mouse to the top or bottom of the screen.
@@ -401,9 +422,19 @@ unsigned int hyperlinkcache_alt = 1024;
  * you have scrolled. 0: off, 1: on, 2: only when keyboard selection mode is on */
 unsigned int scrollbackindicator = 1;
 
-/* Maximum number of lines in the scrollback buffer. Limited to 100000. */
+/* Maximum number of lines in the scrollback buffer. Limited to 1000000, or
+ * to 10000000 if scrollbackdir is set. */
 unsigned int scrollbacklines = 2000;
 
+/* Number of the latest scrollback lines that are kept uncompressed. Older
+ * lines are compressed in blocks of 500 lines and decompressed on demand. */
+unsigned int scrollbackhotlines = 10000;
+
+/* Directory of the temporary file that holds the compressed scrollback
+ * lines. The file is unlinked right away and mapped to memory, so the cold
+ * lines don't stay in RAM. If NULL, the lines are kept on the heap. */
+char *scrollbackdir = NULL;
+
 /*
  * Default colour and shape of the mouse cursor
  */
@@ -481,6 +512,7 @@ static Shortcut shortcuts[] = {
 	{ TERMMOD,              XK_M,           keyboard_url,    { 0 } },
 	{ TERMMOD,              XK_Z,           scrolltoprompt,  {.i = -1}, S_PRI },
 	{ TERMMOD,              XK_X,           scrolltoprompt,  {.i =  1}, S_PRI },
+	{ TERMMOD,              XK_F12,         togglestats,     {.i =  0} },
 	{ XK_NO_MOD,            XK_F11,         fullscreen,      {.i =  0} },
 	{ MODKEY,               XK_Return,      fullscreen,      {.i =  0} },
 	{ MODKEY,               XK_o,           externalpipe,    {.v = copyoutput }, S_PRI },
@@ -855,6 +887,7 @@ ResourcePref resources[] = {
 		{ "minlatency",          FLOAT,   &minlatency },
 		{ "maxlatency",          FLOAT,   &maxlatency },
 		{ "su_timeout",          INTEGER, &su_timeout },
+		{ "reflowtimeout",       INTEGER, &reflowtimeout },
 		{ "blinktimeout",        INTEGER, &blinktimeout },
 		{ "doubleclicktimeout",  INTEGER, &doubleclicktimeout },
 		{ "tripleclicktimeout",  INTEGER, &tripleclicktimeout },
@@ -868,6 +901,7 @@ ResourcePref resources[] = {
 		{ "borderperc",          INTEGER, &borderperc },
 		{ "cwscale",             FLOAT,   &cwscale },
 		{ "chscale",             FLOAT,   &chscale },
+		{ "glyphcachesize",      INTEGER, &glyphcachesize },
 		{ "boxdraw",             INTEGER, &boxdraw },
 		{ "boxdraw_bold",        INTEGER, &boxdraw_bold },
 		{ "boxdraw_braille",     INTEGER, &boxdraw_braille },
@@ -894,4 +928,6 @@ ResourcePref resources[] = {
 		{ "autoscrollacceleration",        FLOAT,   &autoscrollacceleration },
 		{ "scrollbackindicator",           INTEGER, &scrollbackindicator },
 		{ "scrollbacklines",               INTEGER, &scrollbacklines },
+		{ "scrollbackhotlines",            INTEGER, &scrollbackhotlines },
+		{ "scrollbackdir",                 STRING,  &scrollbackdir },
 };
@@ -27,13 +27,16 @@ LIGATURES_LIBS = `$(PKG_CONFIG) --libs harfbuzz`
 # sixel
 SIXEL_C = sixel.c sixel_hls.c
 
+# shared memory image uploads
+XSHM = -lXext
+
 # includes and libs
 INCS = -I$(X11INC) \
        `$(PKG_CONFIG) --cflags fontconfig` \
        `$(PKG_CONFIG) --cflags freetype2` \
        `$(PKG_CONFIG) --cflags imlib2` \
        $(LIGATURES_INC)
-LIBS = -L$(X11LIB) -lm -lX11 -lutil -lXft -lgd $(LIBRT) ${XRENDER} ${XCURSOR} ${PROCSTAT}\
+LIBS = -L$(X11LIB) -lm -lX11 -lutil -lXft -lgd -lpthread $(LIBRT) ${XRENDER} ${XSHM} ${XCURSOR} ${PROCSTAT}\
        `$(PKG_CONFIG) --libs fontconfig` \
        `$(PKG_CONFIG) --libs freetype2` \
        `$(PKG_CONFIG) --libs imlib2` \
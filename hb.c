@@ -1,5 +1,7 @@
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
 #include <X11/Xft/Xft.h>
@@ -9,9 +11,14 @@
 
 #include "st.h"
 #include "hb.h"
+#include "patch/stats.h"
 
 #define BUFFER_STEP 256
 
+/* the shaped runs are cached in sets of CACHE_WAYS runs */
+#define CACHE_SETS 64
+#define CACHE_WAYS 4
+
 hb_font_t *hbfindfont(XftFont *match);
 
 typedef struct {
@@ -32,6 +39,21 @@ typedef struct {
 } RuneBuffer;
 
 static RuneBuffer hbrunebuffer = { 0, NULL };
+
+typedef struct {
+	XftFont *match;
+	uint32_t hash;
+	unsigned long lastuse;
+	unsigned int length;
+	unsigned int count;
+	size_t capacity;
+	Rune *runes;
+	hb_glyph_info_t *glyphs;
+	hb_glyph_position_t *positions;
+} HbShapeCache;
+
+static HbShapeCache hbshapecache[CACHE_SETS][CACHE_WAYS];
+static unsigned long hbshapeclock;
 static hb_buffer_t *hbbuffer;
 extern hb_feature_t hbfeatures[];
 extern unsigned int hbfeaturecount;
@@ -48,9 +70,28 @@ hbdestroybuffer(void)
 	hb_buffer_destroy(hbbuffer);
 }
 
+void
+hbclearcache(void)
+{
+	HbShapeCache *c;
+
+	for (int i = 0; i < CACHE_SETS; i++) {
+		for (int j = 0; j < CACHE_WAYS; j++) {
+			c = &hbshapecache[i][j];
+			free(c->runes);
+			free(c->glyphs);
+			free(c->positions);
+			memset(c, 0, sizeof(*c));
+		}
+	}
+}
+
 void
 hbunloadfonts(void)
 {
+	/* The cached runs refer to the fonts. */
+	hbclearcache();
+
 	for (int i = 0; i < hbfontcache.capacity; i++) {
 		hb_font_destroy(hbfontcache.fonts[i].font);
 		XftUnlockFace(hbfontcache.fonts[i].match);
@@ -88,10 +129,11 @@ hbfindfont(XftFont *match)
 void
 hbtransform(HbTransformData *data, XftFont *xfont, const Glyph *glyphs, int start, int length)
 {
-	uint32_t mode;
+	uint32_t mode, hash;
 	unsigned int glyph_count;
 	int rune_idx, glyph_idx, end = start + length;
 	hb_buffer_t *buffer = hbbuffer;
+	HbShapeCache *set, *cache, *victim;
 
 	hb_font_t *font = hbfindfont(xfont);
 	if (font == NULL) {
@@ -99,10 +141,6 @@ hbtransform(HbTransformData *data, XftFont *xfont, const Glyph *glyphs, int star
 		return;
 	}
 
-	hb_buffer_reset(buffer);
-	hb_buffer_set_direction(buffer, HB_DIRECTION_LTR);
-	hb_buffer_set_cluster_level(buffer, HB_BUFFER_CLUSTER_LEVEL_MONOTONE_CHARACTERS);
-
 	/* Resize the buffer if required length is larger. */
 	if (hbrunebuffer.capacity < length) {
 		hbrunebuffer.capacity = (length / BUFFER_STEP + 1) * BUFFER_STEP;
@@ -116,6 +154,30 @@ hbtransform(HbTransformData *data, XftFont *xfont, const Glyph *glyphs, int star
 		if (mode & ATTR_WDUMMY)
 			hbrunebuffer.runes[rune_idx] = 0x0020;
 	}
+
+	/* Look up the run from the cache. */
+	hash = 2166136261u ^ (uint32_t)(uintptr_t)xfont;
+	for (rune_idx = 0; rune_idx < length; rune_idx++)
+		hash = (hash ^ hbrunebuffer.runes[rune_idx]) * 16777619u;
+	set = hbshapecache[hash % CACHE_SETS];
+	for (victim = cache = set; cache < set + CACHE_WAYS; cache++) {
+		if (cache->match == xfont && cache->hash == hash && cache->length == length &&
+		    !memcmp(cache->runes, hbrunebuffer.runes, length * sizeof(Rune))) {
+			cache->lastuse = ++hbshapeclock;
+			data->buffer = buffer;
+			data->glyphs = cache->glyphs;
+			data->positions = cache->positions;
+			data->count = cache->count;
+			stats.n[STATS_SHAPEHITS]++;
+			return;
+		}
+		if (cache->lastuse < victim->lastuse)
+			victim = cache;
+	}
+
+	hb_buffer_reset(buffer);
+	hb_buffer_set_direction(buffer, HB_DIRECTION_LTR);
+	hb_buffer_set_cluster_level(buffer, HB_BUFFER_CLUSTER_LEVEL_MONOTONE_CHARACTERS);
 	hb_buffer_add_codepoints(buffer, hbrunebuffer.runes, length, 0, length);
 
 	/* Shape the segment. */
@@ -124,6 +186,23 @@ hbtransform(HbTransformData *data, XftFont *xfont, const Glyph *glyphs, int star
 	/* Get new glyph info. */
 	hb_glyph_info_t *info = hb_buffer_get_glyph_infos(buffer, &glyph_count);
 	hb_glyph_position_t *pos = hb_buffer_get_glyph_positions(buffer, &glyph_count);
+	stats.n[STATS_SHAPES]++;
+
+	/* Replace the least recently used run of the set. */
+	if (victim->capacity < MAX(length, glyph_count)) {
+		victim->capacity = (MAX(length, glyph_count) / BUFFER_STEP + 1) * BUFFER_STEP;
+		victim->runes = realloc(victim->runes, victim->capacity * sizeof(Rune));
+		victim->glyphs = realloc(victim->glyphs, victim->capacity * sizeof(hb_glyph_info_t));
+		victim->positions = realloc(victim->positions, victim->capacity * sizeof(hb_glyph_position_t));
+	}
+	memcpy(victim->runes, hbrunebuffer.runes, length * sizeof(Rune));
+	memcpy(victim->glyphs, info, glyph_count * sizeof(hb_glyph_info_t));
+	memcpy(victim->positions, pos, glyph_count * sizeof(hb_glyph_position_t));
+	victim->match = xfont;
+	victim->hash = hash;
+	victim->length = length;
+	victim->count = glyph_count;
+	victim->lastuse = ++hbshapeclock;
 
 	/* Fill the output. */
 	data->buffer = buffer;
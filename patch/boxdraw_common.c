@@ -43,7 +43,7 @@ bd_createmask(BDBuffer *buf)
 
 	gc = XCreateGC(xdpy, maskpixmap, 0, 0);
 	ximage = XCreateImage(xdpy, xvis, 8, ZPixmap, 0, (char *)buf->data, w, h, 8, w);
-	XPutImage(xdpy, maskpixmap, gc, ximage, 0, 0, 0, 0, w, h);
+	xputimage(maskpixmap, gc, ximage, w, h);
 
 	XFreeGC(xdpy, gc);
 	XFreePixmap(xdpy, maskpixmap);
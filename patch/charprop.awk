@@ -0,0 +1,145 @@
+# Generates charprop.inc, the properties of the runes, from the files of
+# the Unicode Character Database:
+#
+#	awk -f charprop.awk EastAsianWidth.txt DerivedGeneralCategory.txt \
+#	    > charprop.inc
+#
+# The files are found in https://www.unicode.org/Public/UCD/latest/ucd/
+# (DerivedGeneralCategory.txt in extracted/).
+#
+# A rune is two cells wide if its East Asian width is W or F. It takes no
+# cell if it's a nonspacing or an enclosing mark, an invisible format
+# character, or a medial vowel or a final consonant of the Hangul jamo.
+# Any other rune is one cell wide.
+
+BEGIN {
+	FS = ";"
+	BLOCKSIZ = 256
+	NRUNES = 1114112
+	for (i = 0; i < 16; i++)
+		hexval[substr("0123456789ABCDEF", i + 1, 1)] = i
+}
+
+function hex(s,    i, v)
+{
+	s = toupper(s)
+	for (i = 1; i <= length(s); i++)
+		v = v * 16 + hexval[substr(s, i, 1)]
+	return v
+}
+
+function trim(s)
+{
+	sub(/^[ \t]+/, "", s)
+	sub(/[ \t]+$/, "", s)
+	return s
+}
+
+# sets or clears the property of the runes
+function setrange(range, set, on,    n, r, first, last, u)
+{
+	n = split(range, r, /\.\./)
+	first = hex(r[1])
+	last = (n > 1) ? hex(r[2]) : first
+	for (u = first; u <= last; u++) {
+		if (on)
+			set[u] = 1
+		else
+			delete set[u]
+	}
+}
+
+FNR == 1 {
+	file = FILENAME
+	sub(/.*\//, "", file)
+	sources = sources " * " trim(substr($0, 2)) "\n"
+}
+
+# the defaults of the unlisted runes come first in the newer files
+/^# @missing:/ {
+	sub(/^# @missing:/, "")
+}
+
+/^#/ || NF < 2 {
+	next
+}
+
+{
+	sub(/#.*/, "")
+	range = trim($1)
+	value = trim($2)
+}
+
+file ~ /^EastAsianWidth/ {
+	setrange(range, wide, value == "W" || value == "F")
+}
+
+file ~ /^DerivedGeneralCategory/ {
+	setrange(range, zero, value == "Mn" || value == "Me" || value == "Cf")
+}
+
+END {
+	# the soft hyphen and the prepended concatenation marks are shown
+	setrange("00AD", zero, 0)
+	setrange("0600..0605", zero, 0)
+	setrange("06DD", zero, 0)
+	setrange("070F", zero, 0)
+	setrange("0890..0891", zero, 0)
+	setrange("08E2", zero, 0)
+	setrange("110BD", zero, 0)
+	setrange("110CD", zero, 0)
+
+	# the Hangul syllables are built from the jamo
+	setrange("1160..11FF", zero, 1)
+	setrange("D7B0..D7C6", zero, 1)
+	setrange("D7CB..D7FB", zero, 1)
+
+	# the blocks that boxdraw may draw, isboxdraw() decides with the options
+	setrange("2500..25FF", boxdraw, 1)
+	setrange("2800..28FF", boxdraw, 1)
+	setrange("F5D0..F6FF", boxdraw, 1)
+	setrange("1CD00..1CDFF", boxdraw, 1)
+	setrange("1FB00..1FBFF", boxdraw, 1)
+
+	nblocks = 0
+	for (b = 0; b < NRUNES / BLOCKSIZ; b++) {
+		key = ""
+		for (u = b * BLOCKSIZ; u < (b + 1) * BLOCKSIZ; u++) {
+			v = (u in zero) ? 0 : (u in wide) ? 2 : 1
+			v += (u in boxdraw) ? 4 : 0
+			key = key v ","
+		}
+		if (!(key in blockid)) {
+			blockid[key] = nblocks
+			blocks[nblocks++] = key
+		}
+		index_[b] = blockid[key]
+	}
+
+	print "/*"
+	printf "%s", sources
+	print " * generated with charprop.awk, do not edit"
+	print " */"
+	printf "static const %s runeblocks[%d] = {\n", \
+	       (nblocks > 256) ? "ushort" : "uchar", NRUNES / BLOCKSIZ
+	for (b = 0; b < NRUNES / BLOCKSIZ; b += 16) {
+		line = "\t"
+		for (i = b; i < b + 16; i++)
+			line = line sprintf("%d,%s", index_[i], (i < b + 15) ? " " : "")
+		print line
+	}
+	print "};"
+	printf "static const uchar runeprops[%d][%d] = {\n", nblocks, BLOCKSIZ
+	for (i = 0; i < nblocks; i++) {
+		n = split(blocks[i], vals, ",")
+		print "\t{"
+		for (j = 1; j < n; j += 32) {
+			line = "\t\t"
+			for (k = j; k < j + 32 && k < n; k++)
+				line = line vals[k] ","
+			print line
+		}
+		print "\t},"
+	}
+	print "};"
+}
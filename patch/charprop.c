@@ -0,0 +1,18 @@
+#include "charprop.inc"
+
+/* returns the properties of the rune in one lookup of the tables */
+int
+runeprop(Rune u)
+{
+	return (u < 0x110000) ? runeprops[runeblocks[u >> 8]][u & 0xff] : 1;
+}
+
+/*
+ * returns the number of cells of the rune. Unlike wcwidth(), it doesn't
+ * depend on the locale or the libc of the host.
+ */
+int
+runewidth(Rune u)
+{
+	return runeprop(u) & RP_WIDTH;
+}
@@ -0,0 +1,8 @@
+/* properties of the runes, see charprop.awk */
+enum runeprop {
+	RP_WIDTH   = 3,      /* the number of cells, 0-2 */
+	RP_BOXDRAW = 1 << 2, /* in the blocks that boxdraw may draw */
+};
+
+int runeprop(Rune);
+int runewidth(Rune);
@@ -4,8 +4,8 @@ extpipe(const Arg *arg, int in)
 	int to[2];
 	char buf[UTF_SIZ];
 	void (*oldsigpipe)(int);
-	int x, y, y1, y2, len, newline;
-	Line line;
+	int x, y, y1, y2, w, len, newline, hbufcol;
+	Line line, hbuf;
 
 	if (pipe(to) == -1)
 		return;
@@ -38,9 +38,20 @@ extpipe(const Arg *arg, int in)
 		;
 	newline = 0;
 
+	/* The history is read line by line without unpacking it. The lines
+	 * that are not reflowed yet are read in the width they were written,
+	 * the wrapped lines are joined the same either way. */
+	hbuf = xmalloc((hbufcol = term.col) * sizeof(Glyph));
 	for (y = y1; y <= y2; y++) {
-		line = TLINEABS(y);
-		len = tlinelen(line);
+		if (y < 0) {
+			if ((w = MAX(term.col, histlinewidth(y))) > hbufcol)
+				hbuf = xrealloc(hbuf, (hbufcol = w) * sizeof(Glyph));
+			loadhistline(y, line = hbuf, w);
+			len = treflow_linelen(line, w);
+		} else {
+			line = term.line[y];
+			len = tlinelen(line);
+		}
 		for (x = 0; x < len; x++) {
 			if (xwrite(to[1], buf, utf8encode(line[x].u, buf)) < 0)
 				break;
@@ -55,6 +66,7 @@ extpipe(const Arg *arg, int in)
 	if (newline)
 		(void)xwrite(to[1], "\n", 1);
 	close(to[1]);
+	free(hbuf);
 
 	/* restore old sigpipe handler */
 	signal(SIGPIPE, oldsigpipe);
@@ -0,0 +1,294 @@
+/*
+ * The fallback fonts found with fontconfig are remembered in a file, so
+ * that the next terminal with the same fonts can open them without
+ * sorting and matching the fonts again. There is a file for every set of
+ * fonts and it is started over when the fontconfig configuration or the
+ * font directories change. Every line maps a range of runes, or a spare
+ * font, to a face in a font file:
+ *
+ *	f <flags> <first rune> <last rune> <index> <file>
+ *	s <hash of the pattern> 0 0 <index> <file>
+ */
+#define FBCACHE_VERSION 1
+
+typedef struct {
+	char kind;     /* 'f' for the fallback fonts, 's' for the spare fonts */
+	uint key;      /* the style flags or the hash of the spare font */
+	Rune first, last;
+	int index;     /* the face in the font file */
+	char *file;
+} FallbackRange;
+
+static struct {
+	FallbackRange *r;
+	int len, cap;
+	FILE *fp;
+	uint config;   /* hash of the fontconfig configuration */
+} fbcache;
+
+static uint
+fbhash(uint h, const void *p, size_t n)
+{
+	const uchar *s = p;
+
+	while (n--)
+		h = (h ^ *s++) * 16777619u;
+	return h;
+}
+
+/*
+ * hashes the pattern without its size, so that the fonts share the cache
+ * at every zoom level. The faces don't depend on the size, it is applied
+ * again when the cached fonts are prepared for the pattern.
+ */
+static uint
+fbpatternhash(uint h, FcPattern *pattern)
+{
+	const char *sizes[] = { FC_SIZE, FC_PIXEL_SIZE, FC_DPI, FC_SCALE };
+	FcPattern *p;
+	FcChar8 *s;
+	int i;
+
+	if (!(p = FcPatternDuplicate(pattern)))
+		return h;
+	for (i = 0; i < LEN(sizes); i++)
+		FcPatternDel(p, sizes[i]);
+	if ((s = FcNameUnparse(p))) {
+		h = fbhash(h, s, strlen((char *)s));
+		free(s);
+	}
+	FcPatternDestroy(p);
+	return h;
+}
+
+/* hashes the configuration files and the font directories with their mtimes */
+static uint
+fbconfighash(void)
+{
+	FcStrList *lists[] = { FcConfigGetConfigFiles(NULL), FcConfigGetFontDirs(NULL) };
+	struct stat st;
+	FcChar8 *s;
+	uint h = 2166136261u;
+	int i, version = FcGetVersion();
+
+	h = fbhash(h, &version, sizeof(version));
+	for (i = 0; i < LEN(lists); i++) {
+		if (!lists[i])
+			continue;
+		while ((s = FcStrListNext(lists[i]))) {
+			h = fbhash(h, s, strlen((char *)s));
+			if (stat((char *)s, &st) == 0)
+				h = fbhash(h, &st.st_mtime, sizeof(st.st_mtime));
+		}
+		FcStrListDone(lists[i]);
+	}
+	return h;
+}
+
+static FallbackRange *
+fbcachefind(char kind, uint key, Rune rune)
+{
+	FallbackRange *r;
+
+	for (r = fbcache.r; r < fbcache.r + fbcache.len; r++) {
+		if (r->kind == kind && r->key == key && rune >= r->first && rune <= r->last)
+			return r;
+	}
+	return NULL;
+}
+
+/* adds the runes to the cache, returns 0 if they were there already */
+static int
+fbcacheput(char kind, uint key, Rune first, Rune last, int index, const char *file)
+{
+	FallbackRange *r;
+
+	for (r = fbcache.r; r < fbcache.r + fbcache.len; r++) {
+		if (r->kind != kind || r->key != key)
+			continue;
+		if (r->index != index || strcmp(r->file, file)) {
+			if (kind != 's')
+				continue;
+			free(r->file);
+			r->index = index;
+			r->file = xstrdup(file);
+			return 1;
+		}
+		if (kind == 's' || (first >= r->first && last <= r->last))
+			return 0;
+		/* extend the range of the font if the runes are next to it */
+		if (first <= r->last + 1 && last + 1 >= r->first) {
+			r->first = MIN(r->first, first);
+			r->last = MAX(r->last, last);
+			return 1;
+		}
+	}
+
+	if (fbcache.len >= fbcache.cap) {
+		fbcache.cap = MAX(2 * fbcache.cap, 64);
+		fbcache.r = xrealloc(fbcache.r, fbcache.cap * sizeof(*fbcache.r));
+	}
+	fbcache.r[fbcache.len++] = (FallbackRange){
+		.kind = kind,
+		.key = key,
+		.first = first,
+		.last = last,
+		.index = index,
+		.file = xstrdup(file),
+	};
+	return 1;
+}
+
+static void
+fbcacheadd(char kind, uint key, Rune rune, FcPattern *match)
+{
+	FcChar8 *file;
+	int index;
+
+	if (FcPatternGetString(match, FC_FILE, 0, &file) != FcResultMatch ||
+	    FcPatternGetInteger(match, FC_INDEX, 0, &index) != FcResultMatch)
+		return;
+	if (!fbcacheput(kind, key, rune, rune, index, (char *)file) || !fbcache.fp)
+		return;
+	/* the lines are short, so the appends of the terminals don't mix */
+	fprintf(fbcache.fp, "%c %x %x %x %d %s\n", kind, key, rune, rune, index, file);
+	fflush(fbcache.fp);
+}
+
+/* returns the font of the cached range prepared for the pattern */
+static FcPattern *
+fbcacheprepare(FallbackRange *r, FcPattern *pattern)
+{
+	FcFontSet *sets[] = {
+		FcConfigGetFonts(NULL, FcSetSystem),
+		FcConfigGetFonts(NULL, FcSetApplication),
+	};
+	FcPattern *font;
+	FcChar8 *file;
+	int i, j, index;
+
+	for (i = 0; i < LEN(sets); i++) {
+		for (j = 0; sets[i] && j < sets[i]->nfont; j++) {
+			font = sets[i]->fonts[j];
+			if (FcPatternGetString(font, FC_FILE, 0, &file) == FcResultMatch &&
+			    FcPatternGetInteger(font, FC_INDEX, 0, &index) == FcResultMatch &&
+			    index == r->index && !strcmp((char *)file, r->file))
+				return FcFontRenderPrepare(NULL, pattern, font);
+		}
+	}
+	return NULL;
+}
+
+static void
+fbcachewrite(const char *path)
+{
+	char tmp[PATH_MAX];
+	FallbackRange *r;
+	FILE *fp;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, getpid()) >= sizeof(tmp) ||
+	    !(fp = fopen(tmp, "w")))
+		return;
+	fprintf(fp, "st-fallback %d %x\n", FBCACHE_VERSION, fbcache.config);
+	for (r = fbcache.r; r < fbcache.r + fbcache.len; r++) {
+		fprintf(fp, "%c %x %x %x %d %s\n", r->kind, r->key, r->first, r->last,
+		        r->index, r->file);
+	}
+	if (fclose(fp) != 0 || rename(tmp, path) < 0)
+		unlink(tmp);
+}
+
+/* loads the cache of the current fonts, called when the fonts are loaded */
+void
+fallbackcacheload(void)
+{
+	Font *fonts[] = { &dc.font, &dc.bfont, &dc.ifont, &dc.ibfont };
+	char path[PATH_MAX], line[PATH_MAX + 64], file[PATH_MAX + 64], kind, *dir;
+	uint hash = 2166136261u, config, key, first, last;
+	int i, n, index, version, valid = 0, lines = 0;
+	FILE *fp;
+
+	if (fbcache.fp)
+		fclose(fbcache.fp);
+	fbcache.fp = NULL;
+	while (fbcache.len > 0)
+		free(fbcache.r[--fbcache.len].file);
+
+	/* the fonts of the process can't change, so the hash is made once */
+	if (!fbcache.config)
+		fbcache.config = fbconfighash();
+	for (i = 0; i < LEN(fonts); i++)
+		hash = fbpatternhash(hash, fonts[i]->pattern);
+
+	if ((dir = getenv("XDG_CACHE_HOME")) && dir[0])
+		n = snprintf(path, sizeof(path), "%s", dir);
+	else if ((dir = getenv("HOME")) && dir[0])
+		n = snprintf(path, sizeof(path), "%s/.cache", dir);
+	else
+		return;
+	if (n >= sizeof(path) - sizeof("/st/fallback-12345678"))
+		return;
+	mkdir(path, 0700);
+	n += sprintf(path + n, "/st");
+	if (mkdir(path, 0700) < 0 && errno != EEXIST)
+		return;
+	sprintf(path + n, "/fallback-%08x", hash);
+
+	if ((fp = fopen(path, "r"))) {
+		if (fgets(line, sizeof(line), fp) &&
+		    sscanf(line, "st-fallback %d %x", &version, &config) == 2 &&
+		    version == FBCACHE_VERSION && config == fbcache.config) {
+			valid = 1;
+			for (; fgets(line, sizeof(line), fp); lines++) {
+				if (sscanf(line, "%c %x %x %x %d %[^\n]", &kind, &key,
+				           &first, &last, &index, file) == 6)
+					fbcacheput(kind, key, first, last, index, file);
+			}
+		}
+		fclose(fp);
+	}
+
+	/* start over if the fonts have changed or there are many duplicates */
+	if (!valid || lines > 2 * fbcache.len + 64)
+		fbcachewrite(path);
+	if ((fbcache.fp = fopen(path, "a")))
+		fcntl(fileno(fbcache.fp), F_SETFD, FD_CLOEXEC);
+}
+
+/* returns the cached fallback font of the rune, or NULL if there is none */
+FcPattern *
+fallbackcachematch(FcPattern *pattern, int flags, Rune rune)
+{
+	FallbackRange *r;
+	FcPattern *query, *match;
+
+	if (!(r = fbcachefind('f', flags, rune)))
+		return NULL;
+	query = xfallbackquery(pattern, rune);
+	match = fbcacheprepare(r, query);
+	FcPatternDestroy(query);
+	return match;
+}
+
+/* matches the spare font, or returns the font it matched before */
+FcPattern *
+fallbackcachespare(FcPattern *pattern)
+{
+	FallbackRange *r;
+	FcPattern *match;
+	FcResult result;
+	uint key = fbpatternhash(2166136261u, pattern);
+
+	if ((r = fbcachefind('s', key, 0)) && (match = fbcacheprepare(r, pattern)))
+		return match;
+	if ((match = FcFontMatch(NULL, pattern, &result)))
+		fbcacheadd('s', key, 0, match);
+	return match;
+}
+
+/* remembers the fallback font that fontconfig found for the rune */
+void
+fallbackcacheadd(int flags, Rune rune, FcPattern *match)
+{
+	fbcacheadd('f', flags, rune, match);
+}
@@ -0,0 +1,6 @@
+#include <sys/stat.h>
+
+static void fallbackcacheload(void);
+static FcPattern *fallbackcachematch(FcPattern *, int, Rune);
+static FcPattern *fallbackcachespare(FcPattern *);
+static void fallbackcacheadd(int, Rune, FcPattern *);
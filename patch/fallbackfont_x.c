@@ -0,0 +1,177 @@
+/*
+ * The fallback fonts are looked up with fontconfig in a thread, so that
+ * a new character doesn't stall the drawing. The thread only uses
+ * fontconfig and the fonts are opened when the results are read.
+ */
+typedef struct {
+	Rune rune;
+	int flags;
+	unsigned long gen;  /* the fonts the lookup was made for */
+	FcPattern *pattern; /* the font, or the matched fallback font when done */
+} FallbackLookup;
+
+static struct {
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	FallbackLookup *queue, *done;
+	int nqueue, ndone;
+	int queuecap, donecap;
+	int fd[2];          /* the thread writes to fd[1] when a lookup is done */
+	unsigned long gen;  /* incremented when the fonts are reloaded */
+	int running;
+} fallback = { .fd = { -1, -1 } };
+
+static void *
+fallbackthread(void *arg)
+{
+	FcFontSet *sets[4] = { NULL };
+	unsigned long gen = 0;
+	FallbackLookup l;
+	FcPattern *match;
+	FcResult fcres;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&fallback.lock);
+		while (!fallback.nqueue)
+			pthread_cond_wait(&fallback.cond, &fallback.lock);
+		l = fallback.queue[0];
+		memmove(fallback.queue, fallback.queue + 1, --fallback.nqueue * sizeof(*fallback.queue));
+		pthread_mutex_unlock(&fallback.lock);
+
+		/* the font sets are sorted once per style */
+		if (l.gen != gen) {
+			for (i = 0; i < LEN(sets); i++) {
+				if (sets[i])
+					FcFontSetDestroy(sets[i]);
+				sets[i] = NULL;
+			}
+			gen = l.gen;
+		}
+		if (!sets[l.flags])
+			sets[l.flags] = FcFontSort(0, l.pattern, 1, 0, &fcres);
+
+		match = xmatchfallbackfont(l.pattern, sets[l.flags], l.rune);
+		FcPatternDestroy(l.pattern);
+		l.pattern = match;
+
+		pthread_mutex_lock(&fallback.lock);
+		if (fallback.ndone >= fallback.donecap) {
+			fallback.donecap = MAX(2 * fallback.donecap, 16);
+			fallback.done = xrealloc(fallback.done, fallback.donecap * sizeof(*fallback.done));
+		}
+		fallback.done[fallback.ndone++] = l;
+		pthread_mutex_unlock(&fallback.lock);
+		write(fallback.fd[1], "", 1);
+	}
+	return NULL;
+}
+
+void
+fallbackinit(void)
+{
+	if (pipe(fallback.fd) < 0) {
+		fallback.fd[0] = fallback.fd[1] = -1;
+		return;
+	}
+	fcntl(fallback.fd[0], F_SETFL, O_NONBLOCK);
+	fcntl(fallback.fd[0], F_SETFD, FD_CLOEXEC);
+	fcntl(fallback.fd[1], F_SETFD, FD_CLOEXEC);
+	pthread_mutex_init(&fallback.lock, NULL);
+	pthread_cond_init(&fallback.cond, NULL);
+
+	/* the lookups are done synchronously if the thread can't be started */
+	if (pthread_create(&fallback.thread, NULL, fallbackthread, NULL)) {
+		close(fallback.fd[0]);
+		close(fallback.fd[1]);
+		fallback.fd[0] = fallback.fd[1] = -1;
+		return;
+	}
+	fallback.running = 1;
+}
+
+/* queues the lookup of the fallback font, returns 0 if it must be done now */
+int
+fallbackrequest(FcPattern *pattern, int flags, Rune rune)
+{
+	if (!fallback.running)
+		return 0;
+
+	pthread_mutex_lock(&fallback.lock);
+	if (fallback.nqueue >= fallback.queuecap) {
+		fallback.queuecap = MAX(2 * fallback.queuecap, 16);
+		fallback.queue = xrealloc(fallback.queue, fallback.queuecap * sizeof(*fallback.queue));
+	}
+	fallback.queue[fallback.nqueue++] = (FallbackLookup){
+		.rune = rune,
+		.flags = flags,
+		.gen = fallback.gen,
+		.pattern = FcPatternDuplicate(pattern),
+	};
+	pthread_cond_signal(&fallback.cond);
+	pthread_mutex_unlock(&fallback.lock);
+	return 1;
+}
+
+/* drops the queued lookups when the fonts are unloaded */
+void
+fallbackreload(void)
+{
+	if (!fallback.running)
+		return;
+
+	pthread_mutex_lock(&fallback.lock);
+	while (fallback.nqueue > 0)
+		FcPatternDestroy(fallback.queue[--fallback.nqueue].pattern);
+	fallback.gen++;
+	pthread_mutex_unlock(&fallback.lock);
+}
+
+/*
+ * opens the fonts of the finished lookups and dirties the characters
+ * that are waiting for them. Returns the number of finished lookups.
+ */
+int
+fallbackresults(void)
+{
+	static FallbackLookup *done;
+	static int donecap;
+	FallbackLookup *l;
+	char buf[64];
+	int f, n, x, y;
+	Line line;
+
+	while (read(fallback.fd[0], buf, sizeof(buf)) > 0)
+		;
+
+	pthread_mutex_lock(&fallback.lock);
+	if ((n = fallback.ndone) > donecap) {
+		donecap = fallback.donecap;
+		done = xrealloc(done, donecap * sizeof(*done));
+	}
+	memcpy(done, fallback.done, n * sizeof(*done));
+	fallback.ndone = 0;
+	pthread_mutex_unlock(&fallback.lock);
+
+	for (l = done; l < done + n; l++) {
+		if (l->gen != fallback.gen || !l->pattern) {
+			if (l->pattern)
+				FcPatternDestroy(l->pattern);
+			continue;
+		}
+		fallbackcacheadd(l->flags, l->rune, l->pattern);
+		f = xaddfallbackfont(l->pattern, l->flags);
+		rfmapput(l->rune, l->flags, f, XftCharIndex(xw.dpy, frc[f].font, l->rune));
+		stats.n[STATS_FCMATCHES]++;
+
+		for (y = 0; y < term.row; y++) {
+			line = TLINE(y);
+			for (x = 0; x < term.col; x++) {
+				if (line[x].u == l->rune)
+					tsetdirtspan(y, x, x+1);
+			}
+		}
+	}
+	return n;
+}
@@ -0,0 +1,7 @@
+#include <fcntl.h>
+#include <pthread.h>
+
+static void fallbackinit(void);
+static int fallbackrequest(FcPattern *, int, Rune);
+static void fallbackreload(void);
+static int fallbackresults(void);
@@ -2,9 +2,8 @@ int
 xloadsparefont(FcPattern *pattern, int flags)
 {
 	FcPattern *match;
-	FcResult result;
 
-	match = FcFontMatch(NULL, pattern, &result);
+	match = fallbackcachespare(pattern);
 	if (!match) {
 		return 1;
 	}
@@ -15,8 +14,9 @@ xloadsparefont(FcPattern *pattern, int flags)
 	}
 
 	frc[frclen].flags = flags;
-	/* Believe U+0000 glyph will present in each default font */
-	frc[frclen].unicodep = 0;
+	frc[frclen].spare = 1;
+	frc[frclen].refs = 0;
+	frc[frclen].lastuse = 0;
 	frclen++;
 
 	return 0;
@@ -87,6 +87,7 @@ xloadsparefonts(void)
 		FcPatternAddBool(pattern, FC_SCALABLE, 1);
 
 		FcConfigSubstitute(NULL, pattern, FcMatchPattern);
+		glyphcacheconfigure(pattern);
 		XftDefaultSubstitute(xw.dpy, xw.scr, pattern);
 
 		if (xloadsparefont(pattern, FRC_NORMAL))
@@ -0,0 +1,67 @@
+/*
+ * The rendered glyphs are kept by Xft in the glyph set of each font. The
+ * glyphs are loaded here before they are drawn, so that the rasterizing
+ * is timed and counted, and the glyphs of the usual characters are loaded
+ * in one go when the fonts are loaded.
+ */
+
+/* sets the memory the font can use for the rendered glyphs */
+void
+glyphcacheconfigure(FcPattern *pattern)
+{
+	if (glyphcachesize <= 0)
+		return;
+	FcPatternDel(pattern, XFT_MAX_GLYPH_MEMORY);
+	FcPatternAddInteger(pattern, XFT_MAX_GLYPH_MEMORY, glyphcachesize * 1024);
+}
+
+/* renders the printable ascii and the box drawing characters of the font */
+void
+glyphcacheprewarm(Font *f)
+{
+	FT_UInt glyphs[(0x7f - 0x20) + (0x25a0 - 0x2500)];
+	Rune u;
+	int n = 0;
+
+	for (u = 0x20; u < 0x7f; u++)
+		glyphs[n++] = XftCharIndex(xw.dpy, f->match, u);
+	/* the box drawing characters are drawn by st if boxdraw is set */
+	for (u = 0x2500; u < 0x25a0 && !boxdraw; u++) {
+		if ((glyphs[n] = XftCharIndex(xw.dpy, f->match, u)))
+			n++;
+	}
+
+	statsstart(STATS_RASTER);
+	XftFontLoadGlyphs(xw.dpy, f->match, FcTrue, glyphs, n);
+	statsstop(STATS_RASTER);
+	stats.n[STATS_GLYPHLOADS] += n;
+}
+
+/* renders the glyphs of the specs that aren't in the glyph sets yet */
+void
+glyphcacheload(const XftGlyphFontSpec *specs, int len)
+{
+	FT_UInt missing[XFT_NMISSING];
+	XftFont *font = NULL;
+	int i, nmissing = 0, loads = 0;
+
+	for (i = 0; i < len; i++) {
+		if (specs[i].font != font) {
+			if (nmissing)
+				XftFontLoadGlyphs(xw.dpy, font, FcTrue, missing, nmissing);
+			nmissing = 0;
+			font = specs[i].font;
+		}
+		/* loads the glyphs itself when the missing list is full */
+		if (XftFontCheckGlyph(xw.dpy, font, FcTrue, specs[i].glyph, missing, &nmissing) &&
+		    !loads++)
+			statsstart(STATS_RASTER);
+	}
+	if (nmissing)
+		XftFontLoadGlyphs(xw.dpy, font, FcTrue, missing, nmissing);
+
+	if (loads) {
+		statsstop(STATS_RASTER);
+		stats.n[STATS_GLYPHLOADS] += loads;
+	}
+}
@@ -0,0 +1,3 @@
+static void glyphcacheconfigure(FcPattern *);
+static void glyphcacheprewarm(Font *);
+static void glyphcacheload(const XftGlyphFontSpec *, int);
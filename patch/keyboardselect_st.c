@@ -78,6 +78,17 @@ typedef struct {
 	size_t size;
 } KCursorArray;
 
+typedef struct {
+	Glyph *g;
+	Rune u;
+} LabelBackup;
+
+typedef struct {
+	LabelBackup *array;
+	size_t used;
+	size_t size;
+} LabelBackupArray;
+
 static int kbds_in_use, kbds_quant;
 static int kbds_seltype = SEL_REGULAR;
 static int kbds_mode;
@@ -90,6 +101,7 @@ static KCursorArray flash_kcursor_record;
 static KCursorArray flash_kcursor_match;
 static RegexKCursorArray regex_kcursor_record;
 static UrlKCursorArray url_kcursor_record;
+static LabelBackupArray label_backup_record;
 static int hit_input_first = 0;
 static Rune hit_input_first_label;
 
@@ -231,6 +243,25 @@ reset_kcursor_array(KCursorArray *a) {
 	a->size = 0;
 }
 
+/* returns the original character of the flash label cell g */
+Rune *
+label_backup(Glyph *g) {
+	LabelBackupArray *a = &label_backup_record;
+	size_t i;
+
+	for (i = a->used; i > 0; i--) {
+		if (a->array[i-1].g == g)
+			return &a->array[i-1].u;
+	}
+	if (a->used == a->size) {
+		a->size = a->size == 0 ? 16 : a->size * 2;
+		a->array = (LabelBackup *)xrealloc(a->array, a->size * sizeof(LabelBackup));
+	}
+	a->array[a->used].g = g;
+	a->array[a->used].u = 0;
+	return &a->array[a->used++].u;
+}
+
 int
 is_in_flash_used_label(Rune label) {
 	int i;
@@ -373,7 +404,7 @@ kbds_deletechar(void)
 int
 kbds_insertchar(Rune u)
 {
-	int w = (wcwidth(u) > 1) ? 2 : 1;
+	int w = (runewidth(u) > 1) ? 2 : 1;
 	int cx = kbds_searchobj.cx;
 	int size = kbds_searchobj.maxlen - cx - w;
 
@@ -521,23 +552,26 @@ kbds_clearhighlights(void)
 	Rune u;
 
 	for (y = (IS_SET(MODE_ALTSCREEN) ? 0 : -term.histf); y < term.row; y++) {
+		/* packed history lines have never been highlighted */
+		if (y < 0 && !term.hist[histindex(y) / MIN_HISTSIZE].glyphs)
+			continue;
 		line = TLINEABS(y);
 		for (x = 0; x < term.col; x++) {
 			if ((kbds_isurlmode()||kbds_isregexmode()) && line[x].mode & ATTR_FLASH_LABEL && hit_input_first == 1 && is_in_flash_used_label(line[x].u) == 1) {
 				line[x].mode &= ~ATTR_FLASH_LABEL;
 				u = line[x].u;
-				line[x].u = line[x].ubk;
-				line[x].ubk = u; //backup the first hit label for judge in double hit
+				line[x].u = *label_backup(&line[x]);
+				*label_backup(&line[x]) = u; //backup the first hit label for judge in double hit
 				continue;
 			}
-			if ((kbds_isurlmode()||kbds_isregexmode()) && line[x].mode & ATTR_FLASH_LABEL && hit_input_first == 1 && is_in_flash_used_double_label(line[x].u) == 1 && line[x-1].ubk == hit_input_first_label) {
+			if ((kbds_isurlmode()||kbds_isregexmode()) && line[x].mode & ATTR_FLASH_LABEL && hit_input_first == 1 && is_in_flash_used_double_label(line[x].u) == 1 && *label_backup(&line[x-1]) == hit_input_first_label) {
 				continue;
 			}
 			if(hit_input_first == 0)
 				line[x].mode &= ~ATTR_HIGHLIGHT;
 			if (line[x].mode & ATTR_FLASH_LABEL) {
 				line[x].mode &= ~ATTR_FLASH_LABEL;
-				line[x].u = line[x].ubk;
+				line[x].u = *label_backup(&line[x]);
 			}
 		}
 	}
@@ -629,6 +663,8 @@ kbds_jumptoprompt(int dy)
 	LIMIT(y, kbds_top(), bot);
 
 	for (; y >= kbds_top() && y <= bot; y += dy) {
+		/* the history is reflowed as far as it is searched */
+		treflowhistory(term.scr - y);
 		for (line = TLINE(y), x = 0; x < term.col; x++) {
 			if (line[x].extra & EXT_FTCS_PROMPT1_START)
 				goto found;
@@ -691,7 +727,7 @@ kbds_ismatch(KCursor c)
 				c = p;
 			}
 		}
-		c.line[c.x].ubk = c.line[c.x].u;
+		*label_backup(&c.line[c.x]) = c.line[c.x].u;
 		insert_char_array(&flash_next_char_record, c.line[c.x].u);
 		insert_kcursor_array(&flash_kcursor_record, c);
 		insert_kcursor_array(&flash_kcursor_match, m);
@@ -700,6 +736,35 @@ kbds_ismatch(KCursor c)
 	return 1;
 }
 
+/*
+ * Returns 0 if no match can start on the line y. Packed history lines are
+ * checked without unpacking them, because the matches are highlighted.
+ */
+int
+kbds_maymatch(int y)
+{
+	static Glyph *hbuf;
+	static int hbufcol;
+	Rune u = kbds_searchobj.str[0].u;
+	int x;
+
+	if (y >= term.scr || IS_SET(MODE_ALTSCREEN) ||
+	    term.hist[histindex(y - term.scr) / MIN_HISTSIZE].glyphs)
+		return 1;
+
+	if (hbufcol < term.col) {
+		hbufcol = term.col;
+		hbuf = xrealloc(hbuf, hbufcol * sizeof(Glyph));
+	}
+	loadhistline(y - term.scr, hbuf, term.col);
+	for (x = 0; x < term.col; x++) {
+		if ((!kbds_searchobj.ignorecase && u == hbuf[x].u) ||
+		    (kbds_searchobj.ignorecase && casefold(u) == casefold(hbuf[x].u)))
+			return 1;
+	}
+	return 0;
+}
+
 int
 kbds_searchall(void)
 {
@@ -718,10 +783,16 @@ kbds_searchall(void)
 	if (!kbds_searchobj.len)
 		return 0;
 
+	/* the whole history is searched, so it is reflowed first */
+	if (!kbds_isflashmode())
+		treflowhistory(term.histf);
+
 	int begin = kbds_isflashmode() ? 0 : kbds_top();
 	int end = kbds_isflashmode() ? MAX(term.row-2, 0) : kbds_bot();
 
 	for (c.y = begin; c.y <= end; c.y++) {
+		if (!kbds_maymatch(c.y))
+			continue;
 		c.line = TLINE(c.y);
 		c.len = tlinelen(c.line);
 		for (c.x = 0; c.x < c.len; c.x++)
@@ -786,7 +857,7 @@ int apply_regex_result(KCursor c, RegexResult result) {
 	regex_kcursor.c = m;
 	regex_kcursor.len = result.len;
 	regex_kcursor.matched_substring = result.matched_substring;
-	regex_kcursor.c.line[regex_kcursor.c.x].ubk = regex_kcursor.c.line[regex_kcursor.c.x].u;
+	*label_backup(&regex_kcursor.c.line[regex_kcursor.c.x]) = regex_kcursor.c.line[regex_kcursor.c.x].u;
 	is_cross_match = 0;
 	// check the match position is cross match
 	for (i = 0; i < regex_kcursor_record.used; i++) {
@@ -999,10 +1070,10 @@ kbds_search_regex(void)
 		if (i == 0) { // first match
 			if (label_need > LEN(flash_key_label) - 1) { // double label
 				label_pos1->mode |= ATTR_FLASH_LABEL;
-				label_pos1->ubk = label_pos1->u;
+				*label_backup(label_pos1) = label_pos1->u;
 				label_pos1->u = label1;
 				label_pos2->mode |= ATTR_FLASH_LABEL;
-				label_pos2->ubk = label_pos2->u;
+				*label_backup(label_pos2) = label_pos2->u;
 				label_pos2->u = label2;
 				insert_char_array(&flash_used_label, label1);
 				insert_char_array(&flash_used_double_label, label2);
@@ -1010,7 +1081,7 @@ kbds_search_regex(void)
 				continue;
 			} else { // single label
 				label_pos1->mode |= ATTR_FLASH_LABEL;
-				label_pos1->ubk = label_pos1->u;
+				*label_backup(label_pos1) = label_pos1->u;
 				label_pos1->u = *flash_key_label[count];
 				insert_char_array(&flash_used_label, *flash_key_label[count]);
 				count++;
@@ -1035,9 +1106,9 @@ kbds_search_regex(void)
 
 		if(label_need > LEN(flash_key_label) - 1) {  // double label
 			label_pos1->mode |= ATTR_FLASH_LABEL;
-			label_pos1->ubk = label_pos1->u;
+			*label_backup(label_pos1) = label_pos1->u;
 			label_pos2->mode |= ATTR_FLASH_LABEL;
-			label_pos2->ubk = label_pos2->u;
+			*label_backup(label_pos2) = label_pos2->u;
 
 			if (is_exists_str == 0) { // new value match, use new label
 				label_pos1->u = label1;
@@ -1051,7 +1122,7 @@ kbds_search_regex(void)
 			}
 		} else {  // single label
 			label_pos1->mode |= ATTR_FLASH_LABEL;
-			label_pos1->ubk = label_pos1->u;
+			*label_backup(label_pos1) = label_pos1->u;
 			label_pos1->u = *flash_key_label[count];
 			if (is_exists_str == 0) { // new value match, use new label
 				label_pos1->u = *flash_key_label[count];
@@ -1185,10 +1256,10 @@ kbds_search_url(void)
 		if (i == 0) { // first match
 			if (label_need > LEN(flash_key_label) - 1) { // double label
 				label_pos1->mode |= ATTR_FLASH_LABEL;
-				label_pos1->ubk = label_pos1->u;
+				*label_backup(label_pos1) = label_pos1->u;
 				label_pos1->u = label1;
 				label_pos2->mode |= ATTR_FLASH_LABEL;
-				label_pos2->ubk = label_pos2->u;
+				*label_backup(label_pos2) = label_pos2->u;
 				label_pos2->u = label2;
 				insert_char_array(&flash_used_label, label1);
 				insert_char_array(&flash_used_double_label, label2);
@@ -1196,7 +1267,7 @@ kbds_search_url(void)
 				continue;
 			} else { // single label
 				label_pos1->mode |= ATTR_FLASH_LABEL;
-				label_pos1->ubk = label_pos1->u;
+				*label_backup(label_pos1) = label_pos1->u;
 				label_pos1->u = *flash_key_label[count];
 				insert_char_array(&flash_used_label, *flash_key_label[count]);
 				count++;
@@ -1221,9 +1292,9 @@ kbds_search_url(void)
 
 		if(label_need > LEN(flash_key_label) - 1) {  // double label
 			label_pos1->mode |= ATTR_FLASH_LABEL;
-			label_pos1->ubk = label_pos1->u;
+			*label_backup(label_pos1) = label_pos1->u;
 			label_pos2->mode |= ATTR_FLASH_LABEL;
-			label_pos2->ubk = label_pos2->u;
+			*label_backup(label_pos2) = label_pos2->u;
 
 			if (is_exists_url == 0) { // new value match, use new label
 				label_pos1->u = label1;
@@ -1237,7 +1308,7 @@ kbds_search_url(void)
 			}
 		} else {  // single label
 			label_pos1->mode |= ATTR_FLASH_LABEL;
-			label_pos1->ubk = label_pos1->u;
+			*label_backup(label_pos1) = label_pos1->u;
 			label_pos1->u = *flash_key_label[count];
 			if (is_exists_url == 0) { // new value match, use new label
 				label_pos1->u = *flash_key_label[count];
@@ -1269,7 +1340,7 @@ jump_to_label(Rune label) {
 				return;
 			}
 			// hit second label
-			if (hit_input_first == 1 && hit_input_first_label == url_kcursor_record.array[i].c.line[url_kcursor_record.array[i].c.x].ubk && label == url_kcursor_record.array[i].c.line[url_kcursor_record.array[i].c.x + 1].u) {
+			if (hit_input_first == 1 && hit_input_first_label == *label_backup(&url_kcursor_record.array[i].c.line[url_kcursor_record.array[i].c.x]) && label == url_kcursor_record.array[i].c.line[url_kcursor_record.array[i].c.x + 1].u) {
 				hit_input_first = 0;
 				kbds_clearhighlights();
 				openUrlOnClick(url_kcursor_record.array[i].c.x, url_kcursor_record.array[i].c.y, url_opener);
@@ -1297,7 +1368,7 @@ jump_to_label(Rune label) {
 				return;
 			}
 			// hit second label
-			if (hit_input_first == 1 && hit_input_first_label == regex_kcursor_record.array[i].c.line[regex_kcursor_record.array[i].c.x].ubk && label == regex_kcursor_record.array[i].c.line[regex_kcursor_record.array[i].c.x + 1].u) {
+			if (hit_input_first == 1 && hit_input_first_label == *label_backup(&regex_kcursor_record.array[i].c.line[regex_kcursor_record.array[i].c.x]) && label == regex_kcursor_record.array[i].c.line[regex_kcursor_record.array[i].c.x + 1].u) {
 				hit_input_first = 0;
 				kbds_clearhighlights();
 				copy_regex_result(regex_kcursor_record.array[i].matched_substring);
@@ -1760,6 +1831,7 @@ kbds_keyboardhandler(KeySym ksym, char *buf, int len, int forcequit)
 		kbds_searchobj.str = xmalloc(term.col * sizeof(Glyph));
 		kbds_searchobj.cx = kbds_searchobj.len = 0;
 		kbds_scrolldownonexit = 0;
+		label_backup_record.used = 0;
 		kbds_in_use = 1;
 		kbds_moveto(term.c.x, term.c.y);
 		kbds_oc = kbds_c;
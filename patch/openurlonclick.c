@@ -324,7 +324,7 @@ drawhyperlinkhint(void)
 		charsize = utf8decode(url + i, &g.u, ulen - i);
 		if (charsize == 0)
 			break;
-		w = wcwidth(g.u);
+		w = runewidth(g.u);
 		MODBIT(g.mode, (w > 1), ATTR_WIDE);
 		xdrawglyph(&g, x, y);
 	}
@@ -66,11 +66,14 @@ deletehyperlink(ushort hlink)
 	links->count--;
 }
 
+#define ISDELETEDHYPERLINK(g) ((g).mode & ATTR_HYPERLINK && \
+	((beg1 <= (g).hlink && (g).hlink <= end1) || (beg2 <= (g).hlink && (g).hlink <= end2)))
+
 static void
 deletehyperlinksbypercent(int percent)
 {
-	Line line;
-	int i, beg1, end1, beg2, end2, n, x, y;
+	Line line, hbuf;
+	int i, beg1, end1, beg2, end2, n, x, y, w, hbufcol;
 	Hyperlinks *links = term.hyperlinks;
 
 	if (!links || links->count <= 0 || percent <= 0)
@@ -92,17 +95,31 @@ deletehyperlinksbypercent(int percent)
 	for (i = beg1; i < beg1 + n; i++)
 		deletehyperlink(i % links->capacity);
 
-	/* Remove the hyperlinks from the screen buffer and the scrollback */
+	/* Remove the hyperlinks from the screen buffer and the scrollback. The
+	 * history lines are checked first, so that only the lines with deleted
+	 * hyperlinks are unpacked. History lines wider than the screen are
+	 * checked to the end, so that no deleted hyperlink is left there. */
+	hbuf = xmalloc((hbufcol = term.col) * sizeof(Glyph));
 	for (y = (IS_SET(MODE_ALTSCREEN) ? 0 : -term.histf); y < term.row; y++) {
-		line = TLINEABS(y);
-		for (x = 0; x < term.col; x++) {
-			if (line[x].mode & ATTR_HYPERLINK) {
-				i = line[x].hlink;
-				if ((beg1 <= i && i <= end1) || (beg2 <= i && i <= end2))
-					line[x].mode &= ~ATTR_HYPERLINK;
+		w = term.col;
+		if (y < 0) {
+			if ((w = MAX(w, histlinewidth(y))) > hbufcol)
+				hbuf = xrealloc(hbuf, (hbufcol = w) * sizeof(Glyph));
+			loadhistline(y, hbuf, w);
+			for (x = 0; x < w; x++) {
+				if (ISDELETEDHYPERLINK(hbuf[x]))
+					break;
 			}
+			if (x == w)
+				continue;
+		}
+		line = TLINEABS(y);
+		for (x = 0; x < w; x++) {
+			if (ISDELETEDHYPERLINK(line[x]))
+				line[x].mode &= ~ATTR_HYPERLINK;
 		}
 	}
+	free(hbuf);
 	tfulldirt();
 }
 
@@ -153,17 +170,28 @@ inserthyperlink(const char *id, const char *url)
 void
 deletehyperlinks(int checkscreen)
 {
-	int x, y;
-	Line line;
+	int x, y, w, hbufcol;
+	Line line, hbuf;
 
 	if (checkscreen) {
+		hbuf = xmalloc((hbufcol = term.col) * sizeof(Glyph));
 		for (y = (IS_SET(MODE_ALTSCREEN) ? 0 : -term.histf); y < term.row; y++) {
-			line = TLINEABS(y);
-			for (x = 0; x < term.col; x++) {
-				if (line[x].mode & ATTR_HYPERLINK)
+			w = term.col;
+			if (y < 0) {
+				if ((w = MAX(w, histlinewidth(y))) > hbufcol)
+					hbuf = xrealloc(hbuf, (hbufcol = w) * sizeof(Glyph));
+				loadhistline(y, line = hbuf, w);
+			} else {
+				line = term.line[y];
+			}
+			for (x = 0; x < w; x++) {
+				if (line[x].mode & ATTR_HYPERLINK) {
+					free(hbuf);
 					return;
+				}
 			}
 		}
+		free(hbuf);
 	}
 
 	deletehyperlinksbypercent(100);
@@ -1,3 +1,5 @@
+#include <sys/mman.h>
+
 void
 kscrolldown(const Arg* a)
 {
@@ -18,7 +20,7 @@ kscrolldown(const Arg* a)
 
 	if (sel.ob.x != -1 && !sel.alt)
 		selmove(-n); /* negate change in term.scr */
-	tfulldirt();
+	tscrolldirt(0, term.row-1, n);
 
 	scroll_images(-1*n);
 
@@ -36,6 +38,7 @@ kscrollup(const Arg* a)
 
 	if (n < 0)
 		n = MAX(term.row / -n, 1);
+	treflowhistory(term.scr + n);
 
 	if (term.scr + n <= term.histf) {
 		term.scr += n;
@@ -46,7 +49,7 @@ kscrollup(const Arg* a)
 
 	if (sel.ob.x != -1 && !sel.alt)
 		selmove(n); /* negate change in term.scr */
-	tfulldirt();
+	tscrolldirt(0, term.row-1, -n);
 
 	scroll_images(n);
 
@@ -54,6 +57,695 @@ kscrollup(const Arg* a)
 		restoremousecursor();
 }
 
+#define LZ_HASHBITS 12
+#define LZ_MINMATCH 4
+
+/*
+ * The compressed chunks can be kept in an unlinked file that is mapped to
+ * memory, so that the kernel can write the cold pages to the disk and drop
+ * them from the page cache. The file is split into blocks whose sizes are
+ * powers of two and the freed blocks are kept in a free list for each size.
+ * The whole address range is reserved up front, so the blocks never move.
+ */
+#define STORE_MINSHIFT 6
+#define STORE_MAXSHIFT 30
+#define STORE_RESERVE  ((size_t)1 << (sizeof(void *) > 4 ? 40 : 28))
+#define STORE_GROW     (1 << 20)
+
+static struct {
+	int fd;
+	uchar *base;
+	size_t top;  /* end of the used blocks */
+	size_t size; /* size of the file */
+	size_t freelist[STORE_MAXSHIFT + 1]; /* offset + 1 of a free block */
+} histstore = { .fd = -1 };
+
+static int
+openhiststore(const char *dir)
+{
+	char *path;
+	int fd;
+
+	path = xmalloc(strlen(dir) + sizeof("/st-scrollback-XXXXXX"));
+	sprintf(path, "%s/st-scrollback-XXXXXX", dir);
+	if ((fd = mkstemp(path)) < 0) {
+		fprintf(stderr, "mkstemp %s: %s\n", path, strerror(errno));
+		free(path);
+		return 0;
+	}
+	unlink(path);
+	free(path);
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	histstore.base = mmap(NULL, STORE_RESERVE, PROT_READ | PROT_WRITE,
+	                      MAP_SHARED, fd, 0);
+	if (histstore.base == MAP_FAILED) {
+		fprintf(stderr, "mmap: %s\n", strerror(errno));
+		close(fd);
+		return 0;
+	}
+	histstore.fd = fd;
+	return 1;
+}
+
+static void
+resethiststore(void)
+{
+	if (histstore.fd < 0 || histstore.size == 0)
+		return;
+	/* give the disk space back */
+	if (ftruncate(histstore.fd, 0) == 0)
+		histstore.size = 0;
+	histstore.top = 0;
+	memset(histstore.freelist, 0, sizeof(histstore.freelist));
+}
+
+static int
+storeshift(int len)
+{
+	int shift = STORE_MINSHIFT;
+
+	while (((size_t)1 << shift) < len)
+		shift++;
+	return shift;
+}
+
+static int
+instore(const uchar *p)
+{
+	return histstore.fd >= 0 && p >= histstore.base &&
+	       p < histstore.base + STORE_RESERVE;
+}
+
+/* allocates len bytes from the store, or from the heap if there is no store */
+static uchar *
+storealloc(int len)
+{
+	int shift = storeshift(len);
+	size_t off, size;
+
+	if (histstore.fd < 0 || shift > STORE_MAXSHIFT)
+		return xmalloc(len);
+
+	if ((off = histstore.freelist[shift])) {
+		off--;
+		memcpy(&histstore.freelist[shift], histstore.base + off, sizeof(size_t));
+		return histstore.base + off;
+	}
+
+	off = histstore.top;
+	if (off + ((size_t)1 << shift) > histstore.size) {
+		size = DIVCEIL(off + ((size_t)1 << shift), STORE_GROW) * STORE_GROW;
+		/* the blocks must be backed by the disk, a page that does not
+		 * fit in a sparse file would raise SIGBUS when it is stored */
+		if (size > STORE_RESERVE || posix_fallocate(histstore.fd,
+		    histstore.size, size - histstore.size) != 0)
+			return xmalloc(len);
+		histstore.size = size;
+	}
+	histstore.top += (size_t)1 << shift;
+	return histstore.base + off;
+}
+
+static void
+storefree(uchar *p, int len)
+{
+	int shift = storeshift(len);
+	size_t off;
+
+	if (!instore(p)) {
+		free(p);
+		return;
+	}
+	off = p - histstore.base;
+	memcpy(p, &histstore.freelist[shift], sizeof(size_t));
+	histstore.freelist[shift] = off + 1;
+}
+
+/* the last compressed chunk read by loadhistline() */
+static HistChunk zcache;
+static int zcachei = -1;
+
+static void
+freepackedhistchunk(HistChunk *c)
+{
+	free(c->cells);
+	free(c->lines);
+	free(c->styles);
+	c->cells = NULL;
+	c->lines = NULL;
+	c->styles = NULL;
+}
+
+static void
+dropzcache(void)
+{
+	freepackedhistchunk(&zcache);
+	zcachei = -1;
+}
+
+/* returns the number of lines in the history chunk c */
+static int
+histchunklines(HistChunk *c)
+{
+	return MIN(term.histsize - (int)(c - term.hist) * MIN_HISTSIZE, MIN_HISTSIZE);
+}
+
+static inline int
+histstylecmp(const HistStyle *s, const Glyph *g)
+{
+	return s->fg != g->fg || s->bg != g->bg || s->extra != g->extra ||
+	       s->hlink != g->hlink;
+}
+
+/* makes room for n new styles in the chunk c */
+static void
+reservehiststyles(HistChunk *c, int n)
+{
+	HistStyle *styles;
+	int i, nlines;
+
+	if (c->nstyles + n <= c->stylesize)
+		return;
+
+	if (c->livestyles + n > c->stylesize / 2) {
+		c->stylesize = MAX(c->stylesize * 2, c->nstyles + n);
+		c->styles = xrealloc(c->styles, c->stylesize * sizeof(HistStyle));
+		return;
+	}
+
+	/* at least half of the styles belong to overwritten lines */
+	styles = xmalloc(c->stylesize * sizeof(HistStyle));
+	nlines = histchunklines(c);
+	for (c->nstyles = i = 0; i < nlines; i++) {
+		memcpy(&styles[c->nstyles], &c->styles[c->lines[i].style],
+		       c->lines[i].nstyles * sizeof(HistStyle));
+		c->lines[i].style = c->nstyles;
+		c->nstyles += c->lines[i].nstyles;
+	}
+	free(c->styles);
+	c->styles = styles;
+}
+
+/* sets the n glyphs at g to the cleared default glyph */
+static void
+clearhistglyphs(Glyph *g, int n)
+{
+	memset(g, 0, MAX(n, 0) * sizeof(Glyph));
+	for (; n > 0; n--)
+		tclearglyph(g++, 0);
+}
+
+/* packs n glyphs from g, the rest of the line is cleared */
+static void
+packhistline(HistChunk *c, int l, const Glyph *g, int n)
+{
+	HistCell *cell = &c->cells[l * c->col];
+	HistLine *line = &c->lines[l];
+	HistStyle *st;
+	Glyph blank;
+	const Glyph *gp;
+	int x, i, ns = 0;
+
+	c->livestyles -= line->nstyles;
+	line->nstyles = 0;
+	reservehiststyles(c, c->col);
+	st = &c->styles[c->nstyles];
+	clearhistglyphs(&blank, 1);
+
+	/* the style table of the line is only searched for recent styles,
+	 * so a style may appear more than once */
+	for (x = 0, i = -1; x < c->col; x++) {
+		gp = (x < n) ? &g[x] : &blank;
+		if (i < 0 || histstylecmp(&st[i], gp)) {
+			for (i = ns - 1; i >= MAX(ns - 4, 0); i--) {
+				if (!histstylecmp(&st[i], gp))
+					break;
+			}
+			if (i < MAX(ns - 4, 0)) {
+				i = ns++;
+				st[i].fg = gp->fg;
+				st[i].bg = gp->bg;
+				st[i].extra = gp->extra;
+				st[i].hlink = gp->hlink;
+			}
+		}
+		cell[x].u = gp->u;
+		cell[x].mode = gp->mode;
+		cell[x].style = i;
+	}
+	line->style = c->nstyles;
+	line->nstyles = ns;
+	c->nstyles += ns;
+	c->livestyles += ns;
+}
+
+/* unpacks the line l to n glyphs, it is truncated or cleared to fit */
+static void
+unpackhistline(HistChunk *c, int l, Glyph *g, int n)
+{
+	HistCell *cell = &c->cells[l * c->col];
+	HistStyle *st;
+	int x;
+
+	if (!c->lines[l].nstyles) {
+		memset(g, 0, n * sizeof(Glyph));
+		return;
+	}
+	st = &c->styles[c->lines[l].style];
+	for (x = 0; x < MIN(n, c->col); x++) {
+		g[x].u = cell[x].u;
+		g[x].mode = cell[x].mode;
+		g[x].fg = st[cell[x].style].fg;
+		g[x].bg = st[cell[x].style].bg;
+		g[x].extra = st[cell[x].style].extra;
+		g[x].hlink = st[cell[x].style].hlink;
+	}
+	clearhistglyphs(&g[x], n - x);
+}
+
+static void
+initpackedhistchunk(HistChunk *c, int n)
+{
+	c->cells = xmalloc(n * c->col * sizeof(HistCell));
+	c->lines = xmalloc(n * sizeof(HistLine));
+	memset(c->lines, 0, n * sizeof(HistLine));
+	c->styles = NULL;
+	c->nstyles = c->livestyles = c->stylesize = 0;
+}
+
+static void
+packhistchunk(HistChunk *c)
+{
+	HistLine *lines = c->lines;
+	int i, n = histchunklines(c);
+
+	initpackedhistchunk(c, n);
+	for (i = 0; i < n; i++) {
+		packhistline(c, i, &c->glyphs[i * c->col], c->col);
+		c->lines[i].width = lines[i].width;
+	}
+	free(lines);
+	free(c->glyphs);
+	c->glyphs = NULL;
+}
+
+/* makes the lines of the packed chunk c col cells wide */
+static void
+widenhistchunk(HistChunk *c, int col)
+{
+	HistChunk old = *c;
+	Glyph *g = xmalloc(col * sizeof(Glyph));
+	int i, n = histchunklines(c);
+
+	c->col = col;
+	initpackedhistchunk(c, n);
+	for (i = 0; i < n; i++) {
+		if (!old.lines[i].nstyles)
+			continue;
+		unpackhistline(&old, i, g, col);
+		packhistline(c, i, g, col);
+		c->lines[i].width = old.lines[i].width;
+	}
+	freepackedhistchunk(&old);
+	free(g);
+}
+
+static uchar *
+putvarint(uchar *p, uint v)
+{
+	for (; v >= 0x80; v >>= 7)
+		*p++ = v | 0x80;
+	*p++ = v;
+	return p;
+}
+
+static const uchar *
+getvarint(const uchar *p, uint *v)
+{
+	int shift;
+
+	for (*v = 0, shift = 0; *p & 0x80; shift += 7)
+		*v |= (uint)(*p++ & 0x7f) << shift;
+	*v |= (uint)*p++ << shift;
+	return p;
+}
+
+/*
+ * LZ77 compression in the style of the LZ4 block format. A sequence is a
+ * token with the literal length in the high and the match length in the
+ * low nibble, the literals and a 16-bit offset. The last sequence has no
+ * match.
+ */
+static uchar *
+lzputlen(uchar *p, uint len)
+{
+	for (; len >= 255; len -= 255)
+		*p++ = 255;
+	*p++ = len;
+	return p;
+}
+
+static int
+lzcompress(const uchar *src, int n, uchar *dst)
+{
+	static int table[1 << LZ_HASHBITS];
+	const uchar *anchor = src, *ip = src, *end = src + n, *ref;
+	uchar *op = dst, *token;
+	uint32_t seq, h;
+	int lit, len;
+
+	for (h = 0; h < LEN(table); h++)
+		table[h] = -1;
+
+	while (ip + LZ_MINMATCH + 5 <= end) {
+		memcpy(&seq, ip, 4);
+		h = (seq * 2654435761u) >> (32 - LZ_HASHBITS);
+		ref = (table[h] >= 0) ? src + table[h] : NULL;
+		table[h] = ip - src;
+		if (!ref || ip - ref > 0xffff || memcmp(ref, ip, 4)) {
+			ip++;
+			continue;
+		}
+		for (len = 4; ip + len < end - 5 && ref[len] == ip[len]; len++)
+			;
+
+		lit = ip - anchor;
+		token = op++;
+		*token = MIN(lit, 15) << 4 | MIN(len - LZ_MINMATCH, 15);
+		if (lit >= 15)
+			op = lzputlen(op, lit - 15);
+		memcpy(op, anchor, lit);
+		op += lit;
+		*op++ = (ip - ref) & 0xff;
+		*op++ = (ip - ref) >> 8;
+		if (len - LZ_MINMATCH >= 15)
+			op = lzputlen(op, len - LZ_MINMATCH - 15);
+		ip += len;
+		anchor = ip;
+	}
+
+	lit = end - anchor;
+	*op++ = MIN(lit, 15) << 4;
+	if (lit >= 15)
+		op = lzputlen(op, lit - 15);
+	memcpy(op, anchor, lit);
+	op += lit;
+
+	return op - dst;
+}
+
+static void
+lzdecompress(const uchar *src, int n, uchar *dst)
+{
+	const uchar *ip = src, *end = src + n, *ref;
+	uint len;
+	uchar token;
+
+	for (;;) {
+		token = *ip++;
+		if ((len = token >> 4) == 15) {
+			do {
+				len += *ip;
+			} while (*ip++ == 255);
+		}
+		memcpy(dst, ip, len);
+		dst += len;
+		if ((ip += len) >= end)
+			break;
+
+		ref = dst - (ip[0] | ip[1] << 8);
+		ip += 2;
+		if ((len = token & 15) == 15) {
+			do {
+				len += *ip;
+			} while (*ip++ == 255);
+		}
+		/* the match may overlap with the output */
+		for (len += LZ_MINMATCH; len > 0; len--)
+			*dst++ = *ref++;
+	}
+}
+
+/*
+ * Serializes the packed chunk c. The styles are stored as they are, the
+ * attributes of the cells are run-length coded and the characters follow
+ * as varints.
+ */
+static int
+serializehistchunk(HistChunk *c, int n, uchar *buf)
+{
+	HistCell *cell;
+	HistStyle *st;
+	uchar *p = buf;
+	int i, x, run;
+
+	for (i = 0; i < n; i++) {
+		p = putvarint(p, c->lines[i].nstyles);
+		if (!c->lines[i].nstyles)
+			continue;
+		p = putvarint(p, c->lines[i].width);
+		for (st = &c->styles[c->lines[i].style], x = 0; x < c->lines[i].nstyles; x++) {
+			memcpy(p, &st[x].fg, 4);
+			memcpy(p + 4, &st[x].bg, 4);
+			memcpy(p + 8, &st[x].extra, 4);
+			memcpy(p + 12, &st[x].hlink, 2);
+			p += 14;
+		}
+		cell = &c->cells[i * c->col];
+		for (x = 0; x < c->col; x += run) {
+			for (run = 1; x + run < c->col &&
+			     cell[x + run].mode == cell[x].mode &&
+			     cell[x + run].style == cell[x].style; run++)
+				;
+			p = putvarint(p, run);
+			p = putvarint(p, cell[x].mode);
+			p = putvarint(p, cell[x].style);
+		}
+		for (x = 0; x < c->col; x++)
+			p = putvarint(p, cell[x].u);
+	}
+	return p - buf;
+}
+
+static void
+deserializehistchunk(HistChunk *c, int n, const uchar *p)
+{
+	HistCell *cell;
+	HistStyle *st;
+	uint nstyles, width, run, mode, style, u;
+	int i, x;
+
+	initpackedhistchunk(c, n);
+	for (i = 0; i < n; i++) {
+		p = getvarint(p, &nstyles);
+		if (!nstyles)
+			continue;
+		p = getvarint(p, &width);
+		reservehiststyles(c, nstyles);
+		c->lines[i].style = c->nstyles;
+		c->lines[i].nstyles = nstyles;
+		c->lines[i].width = width;
+		for (st = &c->styles[c->nstyles], x = 0; x < nstyles; x++) {
+			memcpy(&st[x].fg, p, 4);
+			memcpy(&st[x].bg, p + 4, 4);
+			memcpy(&st[x].extra, p + 8, 4);
+			memcpy(&st[x].hlink, p + 12, 2);
+			p += 14;
+		}
+		c->nstyles += nstyles;
+		c->livestyles += nstyles;
+		cell = &c->cells[i * c->col];
+		for (x = 0; x < c->col; ) {
+			p = getvarint(p, &run);
+			p = getvarint(p, &mode);
+			p = getvarint(p, &style);
+			for (; run > 0; run--, x++) {
+				cell[x].mode = mode;
+				cell[x].style = style;
+			}
+		}
+		for (x = 0; x < c->col; x++) {
+			p = getvarint(p, &u);
+			cell[x].u = u;
+		}
+	}
+}
+
+static void
+compresshistchunk(HistChunk *c)
+{
+	int n = histchunklines(c);
+	uchar *buf, *zbuf;
+
+	/* worst case: every cell has its own style */
+	buf = xmalloc(n * (8 + c->col * (14 + 3 * 5)));
+	c->rawlen = serializehistchunk(c, n, buf);
+	zbuf = xmalloc(c->rawlen + c->rawlen / 255 + 16);
+	c->zlen = lzcompress(buf, c->rawlen, zbuf);
+	c->zdata = storealloc(c->zlen);
+	memcpy(c->zdata, zbuf, c->zlen);
+	free(zbuf);
+	free(buf);
+	freepackedhistchunk(c);
+}
+
+/* decompresses the chunk c into the packed chunk dst */
+static void
+decompresshistchunk(HistChunk *c, HistChunk *dst, int n)
+{
+	uchar *buf = xmalloc(c->rawlen);
+
+	dst->col = c->col;
+	lzdecompress(c->zdata, c->zlen, buf);
+	deserializehistchunk(dst, n, buf);
+	free(buf);
+}
+
+static void
+inflatehistchunk(HistChunk *c)
+{
+	if (zcachei == c - term.hist)
+		dropzcache();
+	decompresshistchunk(c, c, histchunklines(c));
+	storefree(c->zdata, c->zlen);
+	c->zdata = NULL;
+}
+
+/* compresses the packed chunks that are older than the hot lines */
+static void
+compresshistory(void)
+{
+	int i, age, head = term.histi / MIN_HISTSIZE;
+
+	if (term.histf <= 0)
+		return;
+
+	for (i = 0; i < HISTCHUNKS(term.histsize); i++) {
+		if (i == head || !term.hist[i].cells)
+			continue;
+		/* age of the latest line in the chunk */
+		age = term.histi - (i * MIN_HISTSIZE + histchunklines(&term.hist[i]) - 1);
+		if (age < 0)
+			age += term.histsize;
+		if (age >= scrollbackhotlines && age < term.histf)
+			compresshistchunk(&term.hist[i]);
+	}
+}
+
+void
+unpackhistchunk(HistChunk *c)
+{
+	int i, n = histchunklines(c);
+
+	if (c->zdata)
+		inflatehistchunk(c);
+	if (c->col < term.histcol)
+		widenhistchunk(c, term.histcol);
+	c->glyphs = xmalloc(n * c->col * sizeof(Glyph));
+	for (i = 0; i < n; i++)
+		unpackhistline(c, i, &c->glyphs[i * c->col], c->col);
+	/* the widths of the lines are kept */
+	free(c->cells);
+	free(c->styles);
+	c->cells = NULL;
+	c->styles = NULL;
+}
+
+/*
+ * Packs the unpacked history chunks again, except the ones that are on
+ * the screen if keepvisible is set. The pointers returned by histline()
+ * become invalid.
+ */
+void
+packhistory(int keepvisible)
+{
+	int i, first = -1, last = -1;
+
+	if (keepvisible && term.scr > 0) {
+		first = histindex(-term.scr) / MIN_HISTSIZE;
+		last = histindex(MIN(term.row - term.scr, 0) - 1) / MIN_HISTSIZE;
+	}
+	for (i = 0; i < HISTCHUNKS(term.histsize); i++) {
+		if (!term.hist[i].glyphs || (first >= 0 && (first <= last ?
+		    (i >= first && i <= last) : (i >= first || i <= last))))
+			continue;
+		packhistchunk(&term.hist[i]);
+	}
+	compresshistory();
+}
+
+/*
+ * returns the chunk of the history line with index i. A compressed chunk
+ * is decompressed to a cache, so the history can be read line by line.
+ */
+static HistChunk *
+histlinechunk(int i)
+{
+	HistChunk *c = &term.hist[i / MIN_HISTSIZE];
+
+	if (c->glyphs || c->cells)
+		return c;
+	if (zcachei != i / MIN_HISTSIZE) {
+		dropzcache();
+		decompresshistchunk(c, &zcache, histchunklines(c));
+		zcachei = i / MIN_HISTSIZE;
+	}
+	return &zcache;
+}
+
+/* returns the width of the screen the history line y was written on */
+int
+histlinewidth(int y)
+{
+	int i = histindex(y);
+
+	return histlinechunk(i)->lines[i % MIN_HISTSIZE].width;
+}
+
+/* copies col glyphs of the history line y to g without unpacking its chunk */
+void
+loadhistline(int y, Glyph *g, int col)
+{
+	int i = histindex(y);
+	HistChunk *c = histlinechunk(i);
+	int n = MIN(col, c->col);
+
+	if (c->glyphs) {
+		memcpy(g, c->glyphs + i % MIN_HISTSIZE * c->col, n * sizeof(Glyph));
+		clearhistglyphs(&g[n], col - n);
+	} else {
+		unpackhistline(c, i % MIN_HISTSIZE, g, col);
+	}
+}
+
+/* replaces the history line y with the width glyphs of g */
+void
+storehistline(int y, const Glyph *g, int width)
+{
+	int i = histindex(y), l = i % MIN_HISTSIZE;
+	HistChunk *c = &term.hist[i / MIN_HISTSIZE];
+
+	if (c->zdata)
+		inflatehistchunk(c);
+	if (c->col < width) {
+		if (c->glyphs)
+			packhistchunk(c);
+		widenhistchunk(c, width);
+	}
+	if (c->glyphs) {
+		memcpy(c->glyphs + l * c->col, g, width * sizeof(Glyph));
+		clearhistglyphs(c->glyphs + l * c->col + width, c->col - width);
+	} else {
+		packhistline(c, l, g, width);
+	}
+	c->lines[l].width = width;
+
+	/* a new chunk is started, the older ones may have become cold */
+	if (y == -1 && l == 0)
+		compresshistory();
+}
+
 void increasehistorysize(int newsize, int col)
 {
 	int i, oldsize = term.histsize;
@@ -64,14 +756,41 @@ void increasehistorysize(int newsize, int col)
 	while (newsize > term.histsize)
 		term.histsize += MIN_HISTSIZE;
 	term.histsize = MIN(term.histsize, term.histlimit);
-	term.hist = xrealloc(term.hist, term.histsize * sizeof(*term.hist));
+	term.histcol = col;
+	term.hist = xrealloc(term.hist, HISTCHUNKS(term.histsize) * sizeof(*term.hist));
 
-	for (i = oldsize; i < term.histsize; i++)
-		term.hist[i] = xmalloc(col * sizeof(Glyph));
+	/* new lines are added in whole chunks, so the old lines never move */
+	for (i = HISTCHUNKS(oldsize); i < HISTCHUNKS(term.histsize); i++) {
+		term.hist[i].glyphs = NULL;
+		term.hist[i].zdata = NULL;
+		term.hist[i].col = col;
+		initpackedhistchunk(&term.hist[i], histchunklines(&term.hist[i]));
+	}
+}
+
+void freehistory(void)
+{
+	int i;
+
+	for (i = 0; i < HISTCHUNKS(term.histsize); i++) {
+		free(term.hist[i].glyphs);
+		if (term.hist[i].zdata && !instore(term.hist[i].zdata))
+			free(term.hist[i].zdata);
+		freepackedhistchunk(&term.hist[i]);
+	}
+	dropzcache();
+	resethiststore();
+	free(term.hist);
+	term.hist = NULL;
+	term.histf = 0;
+	term.histi = -1;
+	term.histsize = 0;
 }
 
 void sethistorylimit(int limit)
 {
-	LIMIT(limit, 0, MAX_HISTSIZE);
+	if (scrollbackdir && histstore.fd < 0)
+		openhiststore(scrollbackdir);
+	LIMIT(limit, 0, histstore.fd >= 0 ? MAX_FILEHISTSIZE : MAX_HISTSIZE);
 	term.histlimit = limit;
 }
@@ -1,10 +1,9 @@
 #define TLINE(y) ( \
-	(y) < term.scr ? term.hist[(term.histi + (y) - term.scr + 1 + term.histsize) % term.histsize] \
-	               : term.line[(y) - term.scr] \
+	(y) < term.scr ? histline((y) - term.scr) : term.line[(y) - term.scr] \
 )
 
 #define TLINEABS(y) ( \
-	(y) < 0 ? term.hist[(term.histi + (y) + 1 + term.histsize) % term.histsize] : term.line[(y)] \
+	(y) < 0 ? histline(y) : term.line[(y)] \
 )
 
 #define UPDATEWRAPNEXT(alt, col) do { \
@@ -15,12 +14,46 @@
 } while (0);
 
 #define MIN_HISTSIZE 500
-#define MAX_HISTSIZE 100000
+#define MAX_HISTSIZE 1000000
+#define MAX_FILEHISTSIZE 10000000
+
+/* the history is allocated in chunks of MIN_HISTSIZE lines */
+#define HISTCHUNKS(n) DIVCEIL(n, MIN_HISTSIZE)
 
 void kscrolldown(const Arg *);
 void kscrollup(const Arg *);
 void increasehistorysize(int, int);
+void freehistory(void);
 void sethistorylimit(int);
+void unpackhistchunk(HistChunk *);
+void packhistory(int);
+int histlinewidth(int);
+void loadhistline(int, Glyph *, int);
+void storehistline(int, const Glyph *, int);
+
+/* returns the index of the history line y, where -1 is the latest line */
+static inline int
+histindex(int y)
+{
+	int i = term.histi + y + 1;
+
+	return (i < 0) ? i + term.histsize : i;
+}
+
+/*
+ * returns the history line y. The chunk of the line is unpacked and the
+ * pointer stays valid until packhistory() is called.
+ */
+static inline Line
+histline(int y)
+{
+	int i = histindex(y);
+	HistChunk *c = &term.hist[i / MIN_HISTSIZE];
+
+	if (!c->glyphs)
+		unpackhistchunk(c);
+	return c->glyphs + i % MIN_HISTSIZE * c->col;
+}
 
 typedef struct {
 	 uint b;
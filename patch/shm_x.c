@@ -0,0 +1,115 @@
+/*
+ * The images are uploaded through a shared memory segment with the
+ * MIT-SHM extension, so that the pixels aren't copied through the socket.
+ * The segment is reused and grown when needed. XPutImage() is used when
+ * the extension is missing or the server is remote.
+ */
+
+/* smaller images aren't worth the round trip */
+#define SHM_MINSIZE (64 * 1024)
+
+static struct {
+	XShmSegmentInfo info;
+	size_t size;      /* 0 if no segment is attached */
+	int state;        /* 0 if unknown, 1 if available, -1 if not */
+} xshm;
+
+static int xshmerror;
+
+static int
+xshmerrorhandler(Display *dpy, XErrorEvent *ev)
+{
+	xshmerror = 1;
+	return 0;
+}
+
+/* replaces the segment with one of at least size bytes */
+static int
+xshmattach(size_t size)
+{
+	int (*handler)(Display *, XErrorEvent *);
+
+	if (xshm.size) {
+		XShmDetach(xw.dpy, &xshm.info);
+		shmdt(xshm.info.shmaddr);
+		xshm.size = 0;
+	}
+
+	size = MAX(size, 4 * SHM_MINSIZE);
+	if ((xshm.info.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600)) < 0)
+		return 0;
+	if ((xshm.info.shmaddr = shmat(xshm.info.shmid, NULL, 0)) == (char *)-1) {
+		shmctl(xshm.info.shmid, IPC_RMID, NULL);
+		return 0;
+	}
+	xshm.info.readOnly = True;
+
+	/* a remote server can't attach the segment */
+	XSync(xw.dpy, False);
+	xshmerror = 0;
+	handler = XSetErrorHandler(xshmerrorhandler);
+	XShmAttach(xw.dpy, &xshm.info);
+	XSync(xw.dpy, False);
+	XSetErrorHandler(handler);
+
+	/* the segment is removed when both ends have detached it */
+	shmctl(xshm.info.shmid, IPC_RMID, NULL);
+	if (xshmerror) {
+		shmdt(xshm.info.shmaddr);
+		return 0;
+	}
+	xshm.size = size;
+	return 1;
+}
+
+static int
+xshmputimage(Drawable d, GC gc, XImage *image, int width, int height)
+{
+	XImage *shmimage;
+	size_t size;
+	int y, len;
+
+	if (!xshm.state)
+		xshm.state = XShmQueryExtension(xw.dpy) ? 1 : -1;
+	if (xshm.state < 0 || (size_t)image->bytes_per_line * height < SHM_MINSIZE)
+		return 0;
+
+	shmimage = XShmCreateImage(xw.dpy, xw.vis, image->depth, ZPixmap, NULL,
+	                           &xshm.info, width, height);
+	if (!shmimage)
+		return 0;
+	if (shmimage->bits_per_pixel != image->bits_per_pixel ||
+	    (image->bits_per_pixel > 8 && shmimage->byte_order != image->byte_order)) {
+		XDestroyImage(shmimage);
+		return 0;
+	}
+	size = (size_t)shmimage->bytes_per_line * height;
+	if (size > xshm.size && !xshmattach(2 * size)) {
+		XDestroyImage(shmimage);
+		xshm.state = -1;
+		return 0;
+	}
+
+	/* the rows may be padded differently */
+	shmimage->data = xshm.info.shmaddr;
+	len = MIN(image->bytes_per_line, shmimage->bytes_per_line);
+	for (y = 0; y < MIN(height, image->height); y++) {
+		memcpy(shmimage->data + y * shmimage->bytes_per_line,
+		       image->data + y * image->bytes_per_line, len);
+	}
+	XShmPutImage(xw.dpy, d, gc, shmimage, 0, 0, 0, 0, width, height, False);
+
+	/* the segment is reused, so wait until the server has read it */
+	XSync(xw.dpy, False);
+	shmimage->data = NULL;
+	XDestroyImage(shmimage);
+	return 1;
+}
+
+/* puts the image to the drawable like XPutImage() */
+void
+xputimage(Drawable d, GC gc, XImage *image, int width, int height)
+{
+	if (!xshmputimage(d, gc, image, width, height))
+		XPutImage(xw.dpy, d, gc, image, 0, 0, 0, 0, width, height);
+}
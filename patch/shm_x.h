@@ -0,0 +1,5 @@
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+
+static void xputimage(Drawable, GC, XImage *, int, int);
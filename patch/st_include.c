@@ -1,8 +1,10 @@
 /* Patches */
 #include "casefold.c"
+#include "charprop.c"
 #include "externalpipe.c"
 #include "keyboardselect_st.c"
 #include "newterm.c"
 #include "osc7.c"
 #include "osc8_st.c"
 #include "scrollback.c"
+#include "stats.c"
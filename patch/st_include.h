@@ -1,5 +1,6 @@
 /* Patches */
 #include "casefold.h"
+#include "charprop.h"
 #include "externalpipe.h"
 #include "keyboardselect_st.h"
 #include "newterm.h"
@@ -7,3 +8,4 @@
 #include "osc7.h"
 #include "osc8_st.h"
 #include "scrollback.h"
+#include "stats.h"
@@ -0,0 +1,102 @@
+/* stats of the current frame */
+FrameStats stats;
+
+static struct {
+	FrameStats frames[STATS_FRAMES];
+	int head;   /* index of the last frame */
+	int count;  /* nb frames kept */
+	unsigned long total[STATS_COUNTERS];
+	unsigned long nframes;
+	struct timespec start[STATS_PHASES];
+	struct timespec first;
+} statshist = { .head = -1 };
+
+static const char *statsphasenames[STATS_PHASES] = {
+	"read", "draw", "finish", "flush", "raster",
+};
+
+static const char *statscounternames[STATS_COUNTERS] = {
+	"bytes", "lines", "specs", "fallbacks", "fcmatches", "sixels", "shapes",
+	"shapehits", "colors", "colorhits", "fills", "glyphloads", "sgrs",
+	"sgrhits",
+};
+
+void
+statsstart(int phase)
+{
+	clock_gettime(CLOCK_MONOTONIC, &statshist.start[phase]);
+}
+
+void
+statsstop(int phase)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	stats.ms[phase] += TIMEDIFF(now, statshist.start[phase]);
+}
+
+/* ends the current frame */
+void
+statsframe(void)
+{
+	int i;
+
+	if (!statshist.nframes++)
+		clock_gettime(CLOCK_MONOTONIC, &statshist.first);
+	for (i = 0; i < STATS_COUNTERS; i++)
+		statshist.total[i] += stats.n[i];
+
+	statshist.head = (statshist.head + 1) % STATS_FRAMES;
+	statshist.frames[statshist.head] = stats;
+	statshist.count = MIN(statshist.count + 1, STATS_FRAMES);
+	memset(&stats, 0, sizeof(stats));
+}
+
+/* returns the n:th last frame, where 0 is the last one */
+const FrameStats *
+statslast(int n)
+{
+	if (n >= statshist.count)
+		return NULL;
+	return &statshist.frames[(statshist.head - n + STATS_FRAMES) % STATS_FRAMES];
+}
+
+void
+statsreport(FILE *fp)
+{
+	const FrameStats *f;
+	struct timespec now;
+	double sum, max;
+	unsigned long nsum, nmax;
+	int i, j;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	fprintf(fp, "st stats: pid %d, %lu frames in %.1f s, last %d frames:\n",
+	        (int)getpid(), statshist.nframes,
+	        statshist.nframes ? TIMEDIFF(now, statshist.first) / 1E3 : 0.0,
+	        statshist.count);
+	if (!statshist.count)
+		return;
+
+	fprintf(fp, "%-10s %10s %10s\n", "phase", "avg ms", "max ms");
+	for (i = 0; i < STATS_PHASES; i++) {
+		for (sum = max = 0, j = 0; (f = statslast(j)); j++) {
+			sum += f->ms[i];
+			max = MAX(max, f->ms[i]);
+		}
+		fprintf(fp, "%-10s %10.3f %10.3f\n", statsphasenames[i],
+		        sum / statshist.count, max);
+	}
+
+	fprintf(fp, "%-10s %10s %10s %12s\n", "counter", "avg", "max", "total");
+	for (i = 0; i < STATS_COUNTERS; i++) {
+		for (nsum = nmax = 0, j = 0; (f = statslast(j)); j++) {
+			nsum += f->n[i];
+			nmax = MAX(nmax, f->n[i]);
+		}
+		fprintf(fp, "%-10s %10.1f %10lu %12lu\n", statscounternames[i],
+		        (double)nsum / statshist.count, nmax, statshist.total[i]);
+	}
+	fflush(fp);
+}
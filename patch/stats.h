@@ -0,0 +1,44 @@
+/* phases of a frame that are timed */
+enum {
+	STATS_READ,   /* reading and parsing the tty output */
+	STATS_DRAW,   /* drawing the dirty lines */
+	STATS_FINISH, /* drawing the images and copying the frame */
+	STATS_FLUSH,  /* flushing the X requests */
+	STATS_RASTER, /* rendering the glyphs, part of the other phases */
+	STATS_PHASES
+};
+
+/* events that are counted */
+enum {
+	STATS_BYTES,     /* bytes parsed */
+	STATS_LINES,     /* dirty lines drawn */
+	STATS_SPECS,     /* glyph specs drawn */
+	STATS_FALLBACKS, /* glyphs looked up from the fallback fonts */
+	STATS_FCMATCHES, /* fallback fonts searched with fontconfig */
+	STATS_SIXELS,    /* images uploaded to the X server */
+	STATS_SHAPES,    /* runs shaped with harfbuzz */
+	STATS_SHAPEHITS, /* runs found in the shaping cache */
+	STATS_COLORS,    /* colors allocated for drawing */
+	STATS_COLORHITS, /* colors found in the color cache */
+	STATS_FILLS,     /* requests that filled the backgrounds */
+	STATS_GLYPHLOADS, /* glyphs rendered to the glyph sets of the fonts */
+	STATS_SGRS,      /* SGR sequences parsed */
+	STATS_SGRHITS,   /* SGR sequences found in the SGR cache */
+	STATS_COUNTERS
+};
+
+/* the stats of the last frames are kept */
+#define STATS_FRAMES 128
+
+typedef struct {
+	double ms[STATS_PHASES];
+	unsigned long n[STATS_COUNTERS];
+} FrameStats;
+
+extern FrameStats stats;
+
+void statsstart(int);
+void statsstop(int);
+void statsframe(void);
+const FrameStats *statslast(int);
+void statsreport(FILE *);
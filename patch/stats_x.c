@@ -0,0 +1,68 @@
+static int showstats;
+
+void
+togglestats(const Arg *arg)
+{
+	showstats = !showstats;
+	tfulldirt();
+}
+
+/* draws the stats of the last frame in the top right corner */
+void
+drawstats(void)
+{
+	static Glyph g;
+	const FrameStats *f;
+	char buf[3][128];
+	int i, x, y, len;
+
+	if (!showstats || !(f = statslast(0)))
+		return;
+
+	snprintf(buf[0], sizeof(buf[0]), " read %.2f draw %.2f (raster %.2f) finish %.2f flush %.2f ms ",
+	         f->ms[STATS_READ], f->ms[STATS_DRAW], f->ms[STATS_RASTER],
+	         f->ms[STATS_FINISH], f->ms[STATS_FLUSH]);
+	snprintf(buf[1], sizeof(buf[1]), " %lu bytes %lu lines %lu/%lu specs rendered %lu/%lu fallbacks %lu images ",
+	         f->n[STATS_BYTES], f->n[STATS_LINES], f->n[STATS_GLYPHLOADS], f->n[STATS_SPECS],
+	         f->n[STATS_FALLBACKS], f->n[STATS_FCMATCHES], f->n[STATS_SIXELS]);
+	snprintf(buf[2], sizeof(buf[2]), " %lu/%lu runs %lu/%lu colors %lu/%lu sgrs from cache ",
+	         f->n[STATS_SHAPEHITS], f->n[STATS_SHAPEHITS] + f->n[STATS_SHAPES],
+	         f->n[STATS_COLORHITS], f->n[STATS_COLORHITS] + f->n[STATS_COLORS],
+	         f->n[STATS_SGRHITS], f->n[STATS_SGRHITS] + f->n[STATS_SGRS]);
+
+	g.mode = 0;
+	g.fg = defaultbg;
+	g.bg = defaultfg;
+	for (y = 0; y < LEN(buf) && y < term.row; y++) {
+		len = strlen(buf[y]);
+		for (i = MAX(len - term.col, 0), x = MAX(term.col - len, 0); i < len; i++, x++) {
+			g.u = buf[y][i];
+			xdrawglyph(&g, x, y);
+		}
+		/* the overlay is erased on the next frame */
+		term.dirty[y] = 1;
+	}
+}
+
+/* writes the stats report to statsfile or to stderr */
+void
+dumpstats(void)
+{
+	FILE *fp = stderr;
+
+	statsrequested = 0;
+	if (statsfile && !(fp = fopen(statsfile, "a"))) {
+		fprintf(stderr, "fopen %s: %s\n", statsfile, strerror(errno));
+		return;
+	}
+	statsreport(fp);
+	fprintf(fp, "glyph memory per font: %d KiB\n", glyphcachesize > 0 ? glyphcachesize : 1024);
+	if (fp != stderr)
+		fclose(fp);
+}
+
+void
+sigusr2_stats(int sig)
+{
+	statsrequested = 1;
+}
@@ -0,0 +1,6 @@
+static void togglestats(const Arg *);
+static void drawstats(void);
+static void dumpstats(void);
+static void sigusr2_stats(int);
+
+static volatile sig_atomic_t statsrequested;
@@ -4,10 +4,15 @@
 #include "boxdraw_branch.c"
 #include "boxdraw_common.c"
 #include "boxdraw_extra.c"
+#include "fallbackcache_x.c"
+#include "fallbackfont_x.c"
 #include "font2.c"
 #include "fullscreen_x.c"
+#include "glyphcache_x.c"
 #include "keyboardselect_x.c"
 #include "openurlonclick.c"
 #include "osc8_x.c"
+#include "shm_x.c"
+#include "stats_x.c"
 #include "undercurl.c"
 #include "xresources.c"
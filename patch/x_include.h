@@ -4,8 +4,13 @@
 #include "boxdraw_branch.h"
 #include "boxdraw_common.h"
 #include "boxdraw_extra.h"
+#include "fallbackcache_x.h"
+#include "fallbackfont_x.h"
 #include "font2.h"
 #include "fullscreen_x.h"
+#include "glyphcache_x.h"
 #include "keyboardselect_st.h"
 #include "keyboardselect_x.h"
+#include "shm_x.h"
+#include "stats_x.h"
 #include "xresources.h"
@@ -128,6 +128,7 @@ config_reload(int sig)
 		die("Can't open display\n");
 
 	config_init(dpy);
+	tflushsgrcache();
 	xloadcols();
 
 	/* nearly like zoomabs() */
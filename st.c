@@ -42,6 +42,8 @@
 #define STR_ARG_SIZ   40
 #define STR_TERM_ST   "\033\\"
 #define STR_TERM_BEL  "\007"
+#define TTYBUF_MIN    BUFSIZ
+#define TTYBUF_MAX    (64*1024)
 
 /* macros */
 #define IS_SET(flag)    ((term.mode & (flag)) != 0)
@@ -104,6 +106,35 @@ enum escape_state {
 	ESC_DCS        =128,
 };
 
+/* handlers of the bytes of an escape sequence, see tputc() */
+enum esc_action {
+	EA_ESC,              /* the byte after ESC */
+	EA_CSI,
+	EA_DCS,
+	EA_UTF8,
+	EA_ALTCHARSET,
+	EA_TEST,
+};
+
+/* states of the parser of the control sequences */
+enum csi_state {
+	CSI_ENTRY,           /* nothing has been read */
+	CSI_PARAM,           /* reading the arguments */
+	CSI_INTER,           /* an intermediate byte has been read */
+	CSI_IRREGULAR,       /* the sequence is parsed with csiparse() */
+};
+
+/* classes of the bytes in the control sequences */
+enum csi_class {
+	CC_OTHER,
+	CC_DIGIT,
+	CC_SEP,              /* ';' */
+	CC_SUBSEP,           /* ':' */
+	CC_PRIV,             /* '?' */
+	CC_INTER,            /* 0x20-0x2f */
+	CC_FINAL,            /* 0x40-0x7e */
+};
+
 enum decrpm_state {
 	DECRPM_NOT_RECOGNIZED    = 0,
 	DECRPM_SET               = 1,
@@ -145,8 +176,34 @@ typedef struct {
 	Subarg subarg[ESC_ARG_SIZ]; /* colon-separated subarguments */
 	char mode[2];
 	char priv;
+	int state;                  /* state of the parser */
+	int *val;                   /* value being read */
+	int ndigits;                /* nb of digits in the value */
+	int spare;                  /* value of the excess subarguments */
+	uint hash;                  /* hash of the raw string */
 } CSIEscape;
 
+/* the changes of the cursor attributes by a SGR sequence */
+typedef struct {
+	Mode modeand, modeor;
+	uint32_t extraand, extraor;
+	uint32_t fg, bg;
+	int setfg, setbg;
+} SGRDelta;
+
+/* a SGR sequence parsed before, see tsetattr() */
+#define SGRCACHE_SETS 64
+#define SGRCACHE_WAYS 4
+#define SGRCACHE_KEYSIZ 32
+
+typedef struct {
+	char key[SGRCACHE_KEYSIZ];  /* the raw string of the sequence */
+	int len;
+	uint hash;
+	unsigned long lastuse;      /* 0 if the entry is free */
+	SGRDelta d;
+} SGRCacheEntry;
+
 /* STR Escape sequence structs */
 /* ESC type [[ [<priv>] <arg> [;]] <mode>] ESC '\' */
 typedef struct {
@@ -171,6 +228,8 @@ static void initsixel(void);
 static void createsixel(void);
 static inline void readsubargs(char **, int);
 static void csiparse(void);
+static inline int csiputc(Rune);
+static int csiwrite(const char *, int);
 static inline void csireset(void);
 static void osc_color_response(int, int, int);
 static void write_da1(void);
@@ -203,23 +262,35 @@ static void tmoveato(int, int);
 static void tnewline(int);
 static void tputtab(int);
 static void tputc(Rune);
+static void tputascii(const char *, int);
+static int tprintablelen(const char *, int);
+static int tdecoderun(const char *, int, Rune **);
 static void treset(void);
+static void tinitescactions(void);
 static void tscrollup(int, int, int, int);
 static void tscrolldown(int, int);
-static void treflow(int, int);
+static void treflow(int, int, int);
+static void treflowdeferred(void);
+static void treflowoldest(void);
+static void treflowdrop(int);
 static void rscrolldown(int);
 static void tresizedef(int, int);
 static void tresizealt(int, int);
+static int tdefattr(const int *, int, SGRDelta *);
 static void tsetattr(const int *, int);
 static void tsetchar(Rune, const Glyph *, int, int);
 static void tsetdirt(int, int);
+static void tscrolldirt(int, int, int);
 static void tsetscroll(int, int);
 static inline void tsetsixelattr(Line line, int x1, int x2);
 static void tswapscreen(void);
+static void tlinerotate(int);
+static void tlineset(int, Line);
+static void tlinelinear(void);
+static void tlinemirror(int);
 static void tloaddefscreen(int, int);
 static void tloadaltscreen(int, int);
 static void tsetmode(int, int, const int *, int);
-static int twrite(const char *, int, int);
 static void tcontrolcode(uchar );
 static void tdectest(char );
 static void tdefutf8(char);
@@ -245,6 +316,59 @@ static ssize_t xwrite(int, const char *, size_t);
 /* Globals */
 static Selection sel;
 static CSIEscape csiescseq;
+static SGRCacheEntry sgrcache[SGRCACHE_SETS][SGRCACHE_WAYS];
+static unsigned long sgrclock;
+
+/* the handler of the sequence by term.esc, see tinitescactions() */
+static uchar escaction[256];
+
+static const uchar csiclass[128] = {
+	[' '] = CC_INTER, ['!'] = CC_INTER, ['"'] = CC_INTER, ['#'] = CC_INTER,
+	['$'] = CC_INTER, ['%'] = CC_INTER, ['&'] = CC_INTER, ['\''] = CC_INTER,
+	['('] = CC_INTER, [')'] = CC_INTER, ['*'] = CC_INTER, ['+'] = CC_INTER,
+	[','] = CC_INTER, ['-'] = CC_INTER, ['.'] = CC_INTER, ['/'] = CC_INTER,
+	['0'] = CC_DIGIT, ['1'] = CC_DIGIT, ['2'] = CC_DIGIT, ['3'] = CC_DIGIT,
+	['4'] = CC_DIGIT, ['5'] = CC_DIGIT, ['6'] = CC_DIGIT, ['7'] = CC_DIGIT,
+	['8'] = CC_DIGIT, ['9'] = CC_DIGIT, [':'] = CC_SUBSEP, [';'] = CC_SEP,
+	['?'] = CC_PRIV,
+	['@'] = CC_FINAL, ['A'] = CC_FINAL, ['B'] = CC_FINAL, ['C'] = CC_FINAL,
+	['D'] = CC_FINAL, ['E'] = CC_FINAL, ['F'] = CC_FINAL, ['G'] = CC_FINAL,
+	['H'] = CC_FINAL, ['I'] = CC_FINAL, ['J'] = CC_FINAL, ['K'] = CC_FINAL,
+	['L'] = CC_FINAL, ['M'] = CC_FINAL, ['N'] = CC_FINAL, ['O'] = CC_FINAL,
+	['P'] = CC_FINAL, ['Q'] = CC_FINAL, ['R'] = CC_FINAL, ['S'] = CC_FINAL,
+	['T'] = CC_FINAL, ['U'] = CC_FINAL, ['V'] = CC_FINAL, ['W'] = CC_FINAL,
+	['X'] = CC_FINAL, ['Y'] = CC_FINAL, ['Z'] = CC_FINAL, ['['] = CC_FINAL,
+	['\\'] = CC_FINAL, [']'] = CC_FINAL, ['^'] = CC_FINAL, ['_'] = CC_FINAL,
+	['`'] = CC_FINAL, ['a'] = CC_FINAL, ['b'] = CC_FINAL, ['c'] = CC_FINAL,
+	['d'] = CC_FINAL, ['e'] = CC_FINAL, ['f'] = CC_FINAL, ['g'] = CC_FINAL,
+	['h'] = CC_FINAL, ['i'] = CC_FINAL, ['j'] = CC_FINAL, ['k'] = CC_FINAL,
+	['l'] = CC_FINAL, ['m'] = CC_FINAL, ['n'] = CC_FINAL, ['o'] = CC_FINAL,
+	['p'] = CC_FINAL, ['q'] = CC_FINAL, ['r'] = CC_FINAL, ['s'] = CC_FINAL,
+	['t'] = CC_FINAL, ['u'] = CC_FINAL, ['v'] = CC_FINAL, ['w'] = CC_FINAL,
+	['x'] = CC_FINAL, ['y'] = CC_FINAL, ['z'] = CC_FINAL, ['{'] = CC_FINAL,
+	['|'] = CC_FINAL, ['}'] = CC_FINAL, ['~'] = CC_FINAL,
+};
+
+/*
+ * next state of the parser by the class of the byte. The sequences that
+ * don't follow the usual form, like the ones with the private markers
+ * '<', '=' and '>', are parsed with csiparse() when they are complete.
+ */
+#define E CSI_ENTRY
+#define P CSI_PARAM
+#define I CSI_INTER
+#define X CSI_IRREGULAR
+static const uchar csitrans[][CC_FINAL+1] = {
+	/*              OTHER DIGIT SEP SUBSEP PRIV INTER FINAL */
+	[CSI_ENTRY]     = { X,    P,  P,    P,   P,    I,    E },
+	[CSI_PARAM]     = { X,    P,  P,    P,   X,    I,    P },
+	[CSI_INTER]     = { X,    X,  X,    X,   X,    X,    I },
+	[CSI_IRREGULAR] = { X,    X,  X,    X,   X,    X,    X },
+};
+#undef E
+#undef P
+#undef I
+#undef X
 static STREscape strescseq;
 static int iofd = 1;
 static int cmdfd;
@@ -261,6 +385,20 @@ static int su;
 static int twrite_aborted;
 struct timespec sutv;
 
+/* while set, a resize reflows only the screen */
+static int deferreflow;
+/* width of the history before the deferred reflows, 0 if none */
+static int reflowcol;
+/* nb history lines appended by the deferred reflows */
+static int reflowrows;
+/* nb screen rows freed by the deferred reflows, they are refilled from
+ * the history when the reflow settles */
+static int reflowfreed;
+/* nb oldest history lines that were reflowed before they were dropped */
+static int reflowold;
+/* nb history lines after them that are not reflowed to the screen width */
+static int reflowstale;
+
 #include "patch/st_include.h"
 
 static void
@@ -928,33 +1066,68 @@ ttyread_pending(void)
 	return twrite_aborted && !(term.hold & TTYREAD);
 }
 
+/*
+ * Reads from the tty and keeps reading as long as there is more data
+ * available and the given time budget (ms) is not exhausted. The read
+ * buffer grows while the reads keep filling it.
+ */
 size_t
-ttyread(void)
+ttyread(double timeout)
 {
-	static char buf[BUFSIZ];
-	static int buflen = 0;
+	static char *buf;
+	static int bufsiz, buflen;
 	int ret, written;
+	size_t total = 0;
+	struct timespec start, now;
+	struct timespec tv = {0};
+	fd_set rfd;
+
+	if (!buf) {
+		bufsiz = TTYBUF_MIN;
+		buf = xmalloc(bufsiz);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
-	/* append read bytes to unprocessed bytes */
-	ret = twrite_aborted ? 1 : read(cmdfd, buf+buflen, LEN(buf)-buflen);
+	for (;;) {
+		/* append read bytes to unprocessed bytes */
+		ret = twrite_aborted ? 1 : read(cmdfd, buf+buflen, bufsiz-buflen);
 
-	if (ret <= 0) {
-		if (term.hold_at_exit) {
-			tsethold(TTYREAD|TTYWRITE);
-			return 1;
+		if (ret <= 0) {
+			if (term.hold_at_exit) {
+				tsethold(TTYREAD|TTYWRITE);
+				return total + 1;
+			}
+			if (ret < 0)
+				die("couldn't read from shell: %s\n", strerror(errno));
+			exit(0);
 		}
-		if (ret < 0)
-			die("couldn't read from shell: %s\n", strerror(errno));
-		exit(0);
-	}
+		total += ret;
 
-	buflen += twrite_aborted ? 0 : ret;
-	written = twrite(buf, buflen, 0);
-	buflen -= written;
-	/* keep any incomplete UTF-8 byte sequence for the next call */
-	if (buflen > 0)
-		memmove(buf, buf + written, buflen);
-	return ret;
+		if (!twrite_aborted) {
+			if (ret == bufsiz-buflen && bufsiz < TTYBUF_MAX) {
+				bufsiz *= 2;
+				buf = xrealloc(buf, bufsiz);
+			}
+			buflen += ret;
+		}
+		written = twrite(buf, buflen, 0);
+		buflen -= written;
+		/* keep any incomplete UTF-8 byte sequence for the next call */
+		if (buflen > 0)
+			memmove(buf, buf + written, buflen);
+
+		/* stop draining if the synchronized update ended or time is up */
+		if (twrite_aborted || (term.hold & TTYREAD))
+			break;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (TIMEDIFF(now, start) >= timeout)
+			break;
+		FD_ZERO(&rfd);
+		FD_SET(cmdfd, &rfd);
+		if (pselect(cmdfd+1, &rfd, NULL, NULL, &tv, NULL) <= 0)
+			break;
+	}
+	return total;
 }
 
 void
@@ -1032,7 +1205,7 @@ ttywriteraw(const char *s, size_t n)
 				 * again. Empty it.
 				 */
 				if (n < lim)
-					lim = ttyread();
+					lim = ttyread(0);
 				n -= r;
 				s += r;
 			} else {
@@ -1041,7 +1214,7 @@ ttywriteraw(const char *s, size_t n)
 			}
 		}
 		if (FD_ISSET(cmdfd, &rfd))
-			lim = ttyread();
+			lim = ttyread(0);
 	}
 	return;
 
@@ -1166,6 +1339,90 @@ tfulldirt(void)
 {
 	for (int i = 0; i < term.row; i++)
 		term.dirty[i] = 1;
+	term.blitn = 0;
+}
+
+/*
+ * scrolls the lines top to bot up by n lines, or down if n is negative.
+ * The dirtyness moves with the lines and the lines are blitted on the
+ * screen when drawing, so only the exposed lines have to be redrawn.
+ */
+void
+tscrolldirt(int top, int bot, int n)
+{
+	int h;
+
+	bot = MIN(bot, term.row-1);
+	if (top > bot || n == 0)
+		return;
+	h = bot - top + 1;
+
+	/* only one region can be blitted at a time */
+	if (term.blitn && (term.blittop != top || term.blitbot != bot)) {
+		tsetdirt(term.blittop, term.blitbot);
+		term.blitn = 0;
+	}
+	if (abs(n) >= h || abs(term.blitn + n) >= h) {
+		tsetdirt(top, bot);
+		term.blitn = 0;
+		return;
+	}
+
+	if (n > 0) {
+		memmove(&term.dirty[top], &term.dirty[top+n], (h-n) * sizeof(*term.dirty));
+		memmove(&term.dirtyx[top], &term.dirtyx[top+n], (h-n) * sizeof(*term.dirtyx));
+		tsetdirt(bot-n+1, bot);
+	} else {
+		memmove(&term.dirty[top-n], &term.dirty[top], (h+n) * sizeof(*term.dirty));
+		memmove(&term.dirtyx[top-n], &term.dirtyx[top], (h+n) * sizeof(*term.dirtyx));
+		tsetdirt(top, top-n-1);
+	}
+	term.blittop = top;
+	term.blitbot = bot;
+	term.blitn += n;
+}
+
+/* marks the columns x1 to x2-1 of the line y dirty */
+void
+tsetdirtspan(int y, int x1, int x2)
+{
+	if (term.dirty[y] == 1 || x1 >= x2)
+		return;
+
+	if (term.dirty[y]) {
+		x1 = MIN(x1, term.dirtyx[y][0]);
+		x2 = MAX(x2, term.dirtyx[y][1]);
+	}
+	term.dirty[y] = 2;
+	term.dirtyx[y][0] = x1;
+	term.dirtyx[y][1] = x2;
+}
+
+/*
+ * returns the dirty columns x1 to x2-1 of the dirty line y and marks the
+ * line clean. The columns are widened to whole glyphs and to the words of
+ * the same attributes, because they may be shaped into ligatures.
+ */
+void
+tdirtyspan(Line line, int y, int *x1, int *x2)
+{
+	int a = 0, b = term.col;
+
+	if (term.dirty[y] == 2) {
+		a = MAX(term.dirtyx[y][0], 0);
+		b = MIN(term.dirtyx[y][1], term.col);
+		if (a > 0 && (line[a].mode & ATTR_WDUMMY))
+			a--;
+		if (b < term.col && (line[b-1].mode & ATTR_WIDE))
+			b++;
+		while (a > 0 && line[a-1].u != ' ' && !ATTRCMP(line[a-1], line[a]))
+			a--;
+		while (b < term.col && line[b].u != ' ' && !ATTRCMP(line[b-1], line[b]))
+			b++;
+	}
+	term.dirty[y] = 0;
+	*x1 = a;
+	*x2 = b;
 }
 
 void
@@ -1214,20 +1471,18 @@ treset(void)
 				tclearglyph(&term.line[y][x], 0);
 		tdeleteimages();
 		deletehyperlinks(0);
+		if (!IS_SET(MODE_ALTSCREEN)) {
+			/* history lines are as wide as the main screen */
+			freehistory();
+			reflowcol = reflowrows = reflowfreed = 0;
+			reflowold = reflowstale = 0;
+			term.scr = 0;
+			increasehistorysize(MIN_HISTSIZE, term.col);
+		}
 		tswapscreen();
 	}
 	tfulldirt();
 
-	for (i = 0; i < term.histsize; i++)
-		free(term.hist[i]);
-	free(term.hist);
-	term.hist = NULL;
-	term.histf = 0;
-	term.histi = -1;
-	term.scr = 0;
-	term.histsize = 0;
-	increasehistorysize(MIN_HISTSIZE, term.col);
-
 	MODBIT(term.mode, 1, MODE_SIXEL_PRIVATE_PALETTE);
 	sixel_parser_set_default_colors(&sixel_st);
 }
@@ -1238,32 +1493,54 @@ tnew(int col, int row)
 	int i, j;
 
 	for (i = 0; i < 2; i++) {
-		term.line = xmalloc(row * sizeof(Line));
+		term.line = xmalloc(2 * row * sizeof(Line));
 		for (j = 0; j < row; j++)
-			term.line[j] = xmalloc(col * sizeof(Glyph));
+			term.line[j] = term.line[j + row] = xmalloc(col * sizeof(Glyph));
 		term.col = col, term.row = row;
 		tswapscreen();
 	}
 	term.dirty = xmalloc(row * sizeof(*term.dirty));
+	term.dirtyx = xmalloc(row * sizeof(*term.dirtyx));
 	term.dirtyimg = xmalloc(row * sizeof(*term.dirtyimg));
 	term.tabs = xmalloc(col * sizeof(*term.tabs));
+	tinitescactions();
 	treset();
 }
 
+/*
+ * fills the table of the handlers of the escape sequences. When more than
+ * one flag is set, the first of CSI, DCS, UTF8, ALTCHARSET and TEST wins.
+ */
+void
+tinitescactions(void)
+{
+	int e;
+
+	for (e = 0; e < LEN(escaction); e++) {
+		escaction[e] = (e & ESC_CSI) ? EA_CSI :
+		               (e & ESC_DCS) ? EA_DCS :
+		               (e & ESC_UTF8) ? EA_UTF8 :
+		               (e & ESC_ALTCHARSET) ? EA_ALTCHARSET :
+		               (e & ESC_TEST) ? EA_TEST : EA_ESC;
+	}
+}
+
 void
 tswapscreen(void)
 {
 	static Line *altline;
-	static int altcol, altrow;
+	static int altcol, altrow, altbase;
 	Line *tmpline = term.line;
-	int tmpcol = term.col, tmprow = term.row;
+	int tmpcol = term.col, tmprow = term.row, tmpbase = term.linebase;
 	ImageList *im = term.images;
 	Hyperlinks *tmplinks = term.hyperlinks;
 
 	term.line = altline;
 	term.col = altcol, term.row = altrow;
+	term.linebase = altbase;
 	altline = tmpline;
 	altcol = tmpcol, altrow = tmprow;
+	altbase = tmpbase;
 	term.mode ^= MODE_ALTSCREEN;
 
 	term.images = term.images_alt;
@@ -1273,6 +1550,51 @@ tswapscreen(void)
 	term.hyperlinks_alt = tmplinks;
 }
 
+/*
+ * The line buffer holds the screen lines twice in a row, and term.line
+ * points to the first screen line in it. Scrolling the whole screen only
+ * moves term.line, so the lines that leave the screen on one side come
+ * back on the other side without moving any pointers.
+ */
+void
+tlinerotate(int n)
+{
+	Line *buf = term.line - term.linebase;
+
+	term.linebase = (term.linebase + n % term.row + term.row) % term.row;
+	term.line = buf + term.linebase;
+}
+
+/* sets a screen line and its mirror */
+void
+tlineset(int y, Line line)
+{
+	Line *buf = term.line - term.linebase;
+	int i = term.linebase + y;
+
+	buf[i] = line;
+	buf[i < term.row ? i + term.row : i - term.row] = line;
+}
+
+/* moves the screen to the start of the buffer for the resize functions */
+void
+tlinelinear(void)
+{
+	Line *buf = term.line - term.linebase;
+
+	if (term.linebase)
+		memmove(buf, term.line, term.row * sizeof(Line));
+	term.line = buf;
+	term.linebase = 0;
+}
+
+/* copies the screen lines of a linear buffer to the second half */
+void
+tlinemirror(int row)
+{
+	memcpy(term.line + row, term.line, row * sizeof(Line));
+}
+
 void
 tloaddefscreen(int clear, int loadcursor)
 {
@@ -1291,8 +1613,11 @@ tloaddefscreen(int clear, int loadcursor)
 	}
 	if (loadcursor)
 		tcursor(CURSOR_LOAD);
-	if (alt)
+	if (alt) {
 		tresizedef(col, row);
+		if (!deferreflow)
+			treflowdeferred();
+	}
 }
 
 void
@@ -1332,13 +1657,17 @@ tscrolldown(int top, int n)
 		return;
 	n = MIN(n, bot-top+1);
 
-	tsetdirt(top + scr, bot + scr);
+	tscrolldirt(top + scr, bot + scr, -n);
 	tclearregion(0, bot-n+1, term.col-1, bot, 1);
 
-	for (i = bot; i >= top+n; i--) {
-		temp = term.line[i];
-		term.line[i] = term.line[i-n];
-		term.line[i-n] = temp;
+	if (top == 0 && bot == term.row-1) {
+		tlinerotate(-n);
+	} else {
+		for (i = bot; i >= top+n; i--) {
+			temp = term.line[i];
+			tlineset(i, term.line[i-n]);
+			tlineset(i-n, temp);
+		}
 	}
 
 	/* move images, if they are inside the scrolling region */
@@ -1375,32 +1704,42 @@ tscrollup(int top, int bot, int n, int mode)
 	if (savehist) {
 		increasehistorysize(term.histf + n, term.col);
 		for (i = 0; i < n; i++) {
+			/* the oldest line is reflowed before it is overwritten */
+			if (term.histf == term.histsize && reflowstale)
+				treflowoldest();
 			term.histi = (term.histi + 1) % term.histsize;
-			temp = term.hist[term.histi];
+			storehistline(-1, term.line[i], term.col);
 			for (j = 0; j < term.col; j++)
-				tclearglyph(&temp[j], 1);
-			term.hist[term.histi] = term.line[i];
-			term.line[i] = temp;
+				tclearglyph(&term.line[i][j], 1);
+			if (term.histf < term.histsize)
+				term.histf++;
+			else
+				treflowdrop(1);
 		}
-		term.histf = MIN(term.histf + n, term.histsize);
 		s = n;
 		if (term.scr) {
 			j = term.scr;
-			term.scr = MIN(j + n, term.histsize);
+			term.scr = MIN(j + n, term.histf);
 			s = j + n - term.scr;
 		}
-		if (mode != SCROLL_RESIZE)
+		if (mode != SCROLL_RESIZE && term.scr)
 			tfulldirt();
+		else if (mode != SCROLL_RESIZE)
+			tscrolldirt(top, bot, n);
 	} else {
 		tclearregion(0, top, term.col-1, top+n-1, 1);
 		if (mode != SCROLL_RESIZE)
-			tsetdirt(top + scr, bot + scr);
+			tscrolldirt(top + scr, bot + scr, n);
 	}
 
-	for (i = top; i <= bot-n; i++) {
-		temp = term.line[i];
-		term.line[i] = term.line[i+n];
-		term.line[i+n] = temp;
+	if (top == 0 && bot == term.row-1) {
+		tlinerotate(n);
+	} else {
+		for (i = top; i <= bot-n; i++) {
+			temp = term.line[i];
+			tlineset(i, term.line[i+n]);
+			tlineset(i+n, temp);
+		}
 	}
 
 	if (alt || !savehist) {
@@ -1463,6 +1802,9 @@ selscroll(int top, int bot, int n)
 		if (sel.nb.y < top || sel.ne.y > bot)
 			selclear();
 	}
+	/* the cleared selection may have been moved with the lines */
+	if (sel.ob.x == -1)
+		tsetdirt(top, bot);
 }
 
 void
@@ -1531,6 +1873,97 @@ csiparse(void)
 	csiescseq.mode[1] = (p < csiescseq.buf+csiescseq.len) ? *p : '\0';
 }
 
+/*
+ * reads a byte of a control sequence and parses the arguments as they
+ * arrive, returns 1 when the sequence is complete
+ */
+int
+csiputc(Rune u)
+{
+	int class = (u < LEN(csiclass)) ? csiclass[u] : CC_OTHER;
+	Subarg *sub;
+
+	csiescseq.buf[csiescseq.len++] = u;
+	csiescseq.hash = (csiescseq.hash ^ (uchar)u) * 16777619u;
+	if (class == CC_FINAL || csiescseq.len >= sizeof(csiescseq.buf)-1) {
+		if (class != CC_FINAL || csiescseq.state == CSI_IRREGULAR) {
+			csiparse();
+		} else if (csiescseq.state == CSI_INTER) {
+			csiescseq.mode[1] = u;
+		} else {
+			csiescseq.mode[0] = u;
+			csiescseq.mode[1] = '\0';
+		}
+		return 1;
+	}
+
+	csiescseq.state = csitrans[csiescseq.state][class];
+	if (csiescseq.state == CSI_IRREGULAR)
+		return 0;
+
+	switch (class) {
+	case CC_DIGIT:
+		/* longer values would overflow, csiparse() clamps them */
+		if (++csiescseq.ndigits > 9) {
+			csiescseq.state = CSI_IRREGULAR;
+			break;
+		}
+		*csiescseq.val = *csiescseq.val * 10 + (u - '0');
+		break;
+	case CC_SEP:
+		if (csiescseq.narg == ESC_ARG_SIZ) {
+			csiescseq.state = CSI_IRREGULAR;
+			break;
+		}
+		csiescseq.subarg[csiescseq.narg].count = 0;
+		csiescseq.val = &csiescseq.arg[csiescseq.narg++];
+		*csiescseq.val = 0;
+		csiescseq.ndigits = 0;
+		break;
+	case CC_SUBSEP:
+		sub = &csiescseq.subarg[csiescseq.narg-1];
+		if (sub->count < SUB_ARG_SIZ)
+			csiescseq.val = &sub->value[sub->count++];
+		else
+			csiescseq.val = &csiescseq.spare;
+		*csiescseq.val = 0;
+		csiescseq.ndigits = 0;
+		break;
+	case CC_PRIV:
+		csiescseq.priv = 1;
+		break;
+	case CC_INTER:
+		csiescseq.mode[0] = u;
+		break;
+	}
+	return 0;
+}
+
+/*
+ * reads the bytes of a control sequence up to its final byte, returns the
+ * number of bytes read. The control codes and the non-ascii bytes are left
+ * to tputc().
+ */
+int
+csiwrite(const char *buf, int buflen)
+{
+	int n;
+	uchar c;
+
+	for (n = 0; n < buflen; ) {
+		c = buf[n];
+		if (!BETWEEN(c, 0x20, 0x7E))
+			break;
+		n++;
+		if (csiputc(c)) {
+			term.esc = 0;
+			csihandle();
+			break;
+		}
+	}
+	return n;
+}
+
 /* for absolute user moves, when decom is set */
 void
 tmoveato(int x, int y)
@@ -1590,13 +2023,14 @@ tsetchar(Rune u, const Glyph *attr, int x, int y)
 	}
 
 	ftcs = term.line[y][x].extra & (EXT_FTCS_PROMPT1_START | EXT_FTCS_PROMPT1_INPUT);
-	term.dirty[y] = 1;
+	/* the halves of a wide glyph may change too */
+	tsetdirtspan(y, MAX(x-1, 0), MIN(x+2, term.col));
 	term.line[y][x] = *attr;
 	term.line[y][x].u = u;
 	term.line[y][x].mode |= ATTR_SET;
 	term.line[y][x].extra |= ftcs;
 
-	if (isboxdraw(u))
+	if ((runeprop(u) & RP_BOXDRAW) && isboxdraw(u))
 		term.line[y][x].mode |= ATTR_BOXDRAW;
 }
 
@@ -1625,7 +2059,7 @@ tclearregion(int x1, int y1, int x2, int y2, int usecurattr)
 		selclear();
 
 	for (y = y1; y <= y2; y++) {
-		term.dirty[y] = 1;
+		tsetdirtspan(y, x1, x2+1);
 		for (x = x1; x <= x2; x++)
 			tclearglyph(&term.line[y][x], usecurattr);
 	}
@@ -1666,7 +2100,7 @@ tdeletechar(int n)
 	if (regionselected(term.c.x, term.c.y+term.scr, term.col-1, term.c.y+term.scr))
 		selclear();
 
-	term.dirty[term.c.y] = 1;
+	tsetdirtspan(term.c.y, MAX(term.c.x-1, 0), term.col);
 	term.c.state &= ~CURSOR_WRAPNEXT;
 }
 
@@ -1707,7 +2141,7 @@ tinsertblank(int n)
 	if (regionselected(term.c.x, term.c.y+term.scr, term.col-1, term.c.y+term.scr))
 		selclear();
 
-	term.dirty[term.c.y] = 1;
+	tsetdirtspan(term.c.y, MAX(term.c.x-1, 0), term.col);
 	term.c.state &= ~CURSOR_WRAPNEXT;
 }
 
@@ -1803,16 +2237,24 @@ tdefcolor(const int *attr, int *npar, int l)
 	return color;
 }
 
-void
-tsetattr(const int *attr, int l)
+/*
+ * builds the changes of the attributes from the arguments of a SGR
+ * sequence, returns 0 if some of the arguments were wrong
+ */
+int
+tdefattr(const int *attr, int l, SGRDelta *d)
 {
-	int i, utype;
+	int i, utype, ok = 1;
 	int32_t color;
+	Mode m;
+
+	*d = (SGRDelta){ .modeand = ~0, .extraand = ~0 };
 
 	for (i = 0; i < l; i++) {
+		m = 0;
 		switch (attr[i]) {
 		case 0:
-			term.c.attr.mode &= ~(
+			d->modeand &= ~(
 				ATTR_BOLD       |
 				ATTR_FAINT      |
 				ATTR_ITALIC     |
@@ -1821,104 +2263,189 @@ tsetattr(const int *attr, int l)
 				ATTR_REVERSE    |
 				ATTR_INVISIBLE  |
 				ATTR_STRUCK     );
-			term.c.attr.fg = defaultfg;
-			term.c.attr.bg = defaultbg;
-			term.c.attr.extra = 0;
+			d->modeor &= d->modeand;
+			d->fg = defaultfg;
+			d->bg = defaultbg;
+			d->setfg = d->setbg = 1;
+			d->extraand = d->extraor = 0;
 			break;
 		case 1:
-			term.c.attr.mode |= ATTR_BOLD;
+			d->modeor |= ATTR_BOLD;
 			break;
 		case 2:
-			term.c.attr.mode |= ATTR_FAINT;
+			d->modeor |= ATTR_FAINT;
 			break;
 		case 3:
-			term.c.attr.mode |= ATTR_ITALIC;
+			d->modeor |= ATTR_ITALIC;
 			break;
 		case 4:
 			utype = (csiescseq.subarg[i].count > 0) ? csiescseq.subarg[i].value[0] : 1;
 			utype = (!undercurl_style && utype >= 3) ? 0 : utype;
 			LIMIT(utype, 0, 5);
-			term.c.attr.extra = (term.c.attr.extra & ~UNDERLINE_TYPE_MASK) |
-			                     (utype << UNDERLINE_TYPE_SHIFT);
-			MODBIT(term.c.attr.mode, utype > 0, ATTR_UNDERLINE);
+			d->extraand &= ~UNDERLINE_TYPE_MASK;
+			d->extraor = (d->extraor & ~UNDERLINE_TYPE_MASK) |
+			             (utype << UNDERLINE_TYPE_SHIFT);
+			if (utype > 0)
+				d->modeor |= ATTR_UNDERLINE;
+			else
+				m = ATTR_UNDERLINE;
 			break;
 		case 5: /* slow blink */
 			/* FALLTHROUGH */
 		case 6: /* rapid blink */
-			term.c.attr.mode |= ATTR_BLINK;
+			d->modeor |= ATTR_BLINK;
 			break;
 		case 7:
-			term.c.attr.mode |= ATTR_REVERSE;
+			d->modeor |= ATTR_REVERSE;
 			break;
 		case 8:
-			term.c.attr.mode |= ATTR_INVISIBLE;
+			d->modeor |= ATTR_INVISIBLE;
 			break;
 		case 9:
-			term.c.attr.mode |= ATTR_STRUCK;
+			d->modeor |= ATTR_STRUCK;
 			break;
 		case 22:
-			term.c.attr.mode &= ~(ATTR_BOLD | ATTR_FAINT);
+			m = ATTR_BOLD | ATTR_FAINT;
 			break;
 		case 23:
-			term.c.attr.mode &= ~ATTR_ITALIC;
+			m = ATTR_ITALIC;
 			break;
 		case 24:
-			term.c.attr.mode &= ~ATTR_UNDERLINE;
+			m = ATTR_UNDERLINE;
 			break;
 		case 25:
-			term.c.attr.mode &= ~ATTR_BLINK;
+			m = ATTR_BLINK;
 			break;
 		case 27:
-			term.c.attr.mode &= ~ATTR_REVERSE;
+			m = ATTR_REVERSE;
 			break;
 		case 28:
-			term.c.attr.mode &= ~ATTR_INVISIBLE;
+			m = ATTR_INVISIBLE;
 			break;
 		case 29:
-			term.c.attr.mode &= ~ATTR_STRUCK;
+			m = ATTR_STRUCK;
 			break;
 		case 38:
-			if ((color = tdefcolor(attr, &i, l)) >= 0)
-				term.c.attr.fg = color;
+			if ((color = tdefcolor(attr, &i, l)) >= 0) {
+				d->fg = color;
+				d->setfg = 1;
+			} else {
+				ok = 0;
+			}
 			break;
 		case 39: /* set foreground color to default */
-			term.c.attr.fg = defaultfg;
+			d->fg = defaultfg;
+			d->setfg = 1;
 			break;
 		case 48:
-			if ((color = tdefcolor(attr, &i, l)) >= 0)
-				term.c.attr.bg = color;
+			if ((color = tdefcolor(attr, &i, l)) >= 0) {
+				d->bg = color;
+				d->setbg = 1;
+			} else {
+				ok = 0;
+			}
 			break;
 		case 49: /* set background color to default */
-			term.c.attr.bg = defaultbg;
+			d->bg = defaultbg;
+			d->setbg = 1;
 			break;
 		case 58:
 			if ((color = tdefcolor(attr, &i, l)) >= 0) {
-				term.c.attr.extra = (term.c.attr.extra & ~UNDERLINE_COLOR_MASK) |
+				d->extraand &= ~UNDERLINE_COLOR_MASK;
+				d->extraor = (d->extraor & ~UNDERLINE_COLOR_MASK) |
 					(IS_TRUECOL(color) ? EXT_UNDERLINE_COLOR_RGB : EXT_UNDERLINE_COLOR_PALETTE) |
 					(color & 0xffffff);
+			} else {
+				ok = 0;
 			}
 			break;
 		case 59: /* reset underline color */
-			term.c.attr.extra &= ~UNDERLINE_COLOR_MASK;
+			d->extraand &= ~UNDERLINE_COLOR_MASK;
+			d->extraor &= ~UNDERLINE_COLOR_MASK;
 			break;
 		default:
 			if (BETWEEN(attr[i], 30, 37)) {
-				term.c.attr.fg = attr[i] - 30;
+				d->fg = attr[i] - 30;
+				d->setfg = 1;
 			} else if (BETWEEN(attr[i], 40, 47)) {
-				term.c.attr.bg = attr[i] - 40;
+				d->bg = attr[i] - 40;
+				d->setbg = 1;
 			} else if (BETWEEN(attr[i], 90, 97)) {
-				term.c.attr.fg = attr[i] - 90 + 8;
+				d->fg = attr[i] - 90 + 8;
+				d->setfg = 1;
 			} else if (BETWEEN(attr[i], 100, 107)) {
-				term.c.attr.bg = attr[i] - 100 + 8;
+				d->bg = attr[i] - 100 + 8;
+				d->setbg = 1;
 			} else {
 				fprintf(stderr,
 					"erresc(default): gfx attr %d unknown\n",
 					attr[i]);
 				csidump();
+				ok = 0;
 			}
 			break;
 		}
+		/* the cleared attributes */
+		d->modeand &= ~m;
+		d->modeor &= ~m;
 	}
+	return ok;
+}
+
+/*
+ * sets the attributes of the cursor. The changes of the sequences are
+ * cached by their arguments, as the same few colors are set over and
+ * over again by colored output.
+ */
+void
+tsetattr(const int *attr, int l)
+{
+	SGRCacheEntry *set, *e, *victim;
+	SGRDelta tmp, *d = &tmp;
+	uint h = csiescseq.hash;
+	int len = csiescseq.len;
+
+	if (len <= SGRCACHE_KEYSIZ) {
+		set = sgrcache[h % SGRCACHE_SETS];
+		for (victim = e = set; e < set + SGRCACHE_WAYS; e++) {
+			if (e->lastuse && e->hash == h && e->len == len &&
+			    !memcmp(e->key, csiescseq.buf, len)) {
+				e->lastuse = ++sgrclock;
+				d = &e->d;
+				stats.n[STATS_SGRHITS]++;
+				goto apply;
+			}
+			if (e->lastuse < victim->lastuse)
+				victim = e;
+		}
+		/* the sequences with errors are parsed again to report them */
+		d = &victim->d;
+		victim->lastuse = 0;
+		if (tdefattr(attr, l, d)) {
+			memcpy(victim->key, csiescseq.buf, len);
+			victim->len = len;
+			victim->hash = h;
+			victim->lastuse = ++sgrclock;
+		}
+	} else {
+		tdefattr(attr, l, d);
+	}
+	stats.n[STATS_SGRS]++;
+
+apply:
+	term.c.attr.mode = (term.c.attr.mode & d->modeand) | d->modeor;
+	term.c.attr.extra = (term.c.attr.extra & d->extraand) | d->extraor;
+	if (d->setfg)
+		term.c.attr.fg = d->fg;
+	if (d->setbg)
+		term.c.attr.bg = d->bg;
+}
+
+/* drops the cached attribute changes, they depend on the configuration */
+void
+tflushsgrcache(void)
+{
+	memset(sgrcache, 0, sizeof(sgrcache));
 }
 
 void
@@ -2223,6 +2750,7 @@ csihandle(void)
 			term.scr = 0;
 			term.histf = 0;
 			term.histi = -1;
+			reflowold = reflowstale = 0;
 			for (im = term.images; im; im = next) {
 				next = im->next;
 				if (im->y < 0)
@@ -2549,6 +3077,13 @@ csireset(void)
 {
 	csiescseq.len = 0;
 	memset(&csiescseq.arg, 0, sizeof(csiescseq.arg));
+	csiescseq.narg = 1;
+	csiescseq.subarg[0].count = 0;
+	csiescseq.priv = 0;
+	csiescseq.state = CSI_ENTRY;
+	csiescseq.val = &csiescseq.arg[0];
+	csiescseq.ndigits = 0;
+	csiescseq.hash = 2166136261u;
 }
 
 void
@@ -3382,8 +3917,8 @@ tputc(Rune u)
 		width = len = 1;
 	} else {
 		len = utf8encode(u, c);
-		if (!control && (width = wcwidth(u)) == -1)
-			width = 1;
+		if (!control)
+			width = runewidth(u);
 	}
 
 	if (IS_SET(MODE_PRINT))
@@ -3453,17 +3988,14 @@ check_control_code:
 			term.lastc = 0;
 		return;
 	} else if (term.esc & ESC_START) {
-		if (term.esc & ESC_CSI) {
-			csiescseq.buf[csiescseq.len++] = u;
-			if (BETWEEN(u, 0x40, 0x7E)
-					|| csiescseq.len >= \
-					sizeof(csiescseq.buf)-1) {
+		switch (escaction[term.esc & 0xff]) {
+		case EA_CSI:
+			if (csiputc(u)) {
 				term.esc = 0;
-				csiparse();
 				csihandle();
 			}
 			return;
-		} else if (term.esc & ESC_DCS) {
+		case EA_DCS:
 			if (strescseq.len < STR_BUF_SIZ-1 && strescseq.len < sizeof(csiescseq.buf)-1) {
 				strescseq.buf[strescseq.len++] = u;
 				csiescseq.buf[csiescseq.len++] = u;
@@ -3476,13 +4008,16 @@ check_control_code:
 				}
 			}
 			return;
-		} else if (term.esc & ESC_UTF8) {
+		case EA_UTF8:
 			tdefutf8(u);
-		} else if (term.esc & ESC_ALTCHARSET) {
+			break;
+		case EA_ALTCHARSET:
 			tdeftran(u);
-		} else if (term.esc & ESC_TEST) {
+			break;
+		case EA_TEST:
 			tdectest(u);
-		} else {
+			break;
+		default:
 			if (!eschandle(u))
 				return;
 			/* sequence already finished */
@@ -3528,6 +4063,7 @@ check_control_code:
 			if ((gp[1].mode & ATTR_WIDE) && term.c.x+2 < term.col) {
 				gp[2].u = ' ';
 				gp[2].mode &= ~ATTR_WDUMMY;
+				tsetdirtspan(term.c.y, term.c.x+2, term.c.x+3);
 			}
 			gp[1].u = '\0';
 			gp[1].mode = ATTR_WDUMMY | ATTR_SET;
@@ -3541,12 +4077,153 @@ check_control_code:
 	}
 }
 
+/*
+ * Returns the length of the run of printable ASCII characters at the start
+ * of the buffer. A word is checked at a time: a byte outside 0x20-0x7e sets
+ * its high bit in either the byte itself, byte+1 or byte-0x20. Carries and
+ * borrows between the bytes can only cause false positives, which are then
+ * resolved by checking the word a byte at a time.
+ */
+int
+tprintablelen(const char *s, int n)
+{
+	const uint64_t ones = (uint64_t)-1 / 0xff;
+	uint64_t w;
+	int i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		memcpy(&w, s + i, 8);
+		if ((w | (w + ones) | (w - 0x20 * ones)) & (0x80 * ones))
+			break;
+	}
+	for (; i < n && BETWEEN(s[i], 0x20, 0x7e); i++)
+		;
+	return i;
+}
+
+/*
+ * Decodes the run of non-ASCII characters at the start of the buffer into
+ * a staging buffer and returns the number of runes. The run ends at an
+ * ASCII byte, a C1 control, a malformed or an incomplete sequence, which
+ * are left to utf8decode(). A sequence is checked and decoded at once,
+ * without the loops of utf8decode().
+ */
+int
+tdecoderun(const char *buf, int buflen, Rune **runes)
+{
+	static Rune *rbuf;
+	static int rbufsiz;
+	const uchar *s = (const uchar *)buf;
+	int i = 0, n = 0;
+	Rune u;
+
+	if (buflen / 2 > rbufsiz) {
+		rbufsiz = MAX(buflen / 2, 256);
+		rbuf = xrealloc(rbuf, rbufsiz * sizeof(Rune));
+	}
+
+	while (i + 1 < buflen) {
+		if (!BETWEEN(s[i], 0xC2, 0xF4) || (s[i+1] & 0xC0) != 0x80) {
+			break;
+		} else if (s[i] < 0xE0) {
+			u = (s[i] & 0x1F) << 6 | (s[i+1] & 0x3F);
+			if (u < 0xA0)
+				break;
+			i += 2;
+		} else if (s[i] < 0xF0) {
+			if (i + 2 >= buflen || (s[i+2] & 0xC0) != 0x80)
+				break;
+			u = (s[i] & 0x0F) << 12 | (s[i+1] & 0x3F) << 6 | (s[i+2] & 0x3F);
+			if (u < 0x800 || BETWEEN(u, 0xD800, 0xDFFF))
+				break;
+			i += 3;
+		} else {
+			if (i + 3 >= buflen || (s[i+2] & 0xC0) != 0x80 ||
+			    (s[i+3] & 0xC0) != 0x80)
+				break;
+			u = (s[i] & 0x07) << 18 | (s[i+1] & 0x3F) << 12 |
+			    (s[i+2] & 0x3F) << 6 | (s[i+3] & 0x3F);
+			if (!BETWEEN(u, 0x10000, 0x10FFFF))
+				break;
+			i += 4;
+		}
+		rbuf[n++] = u;
+	}
+	*runes = rbuf;
+	return n;
+}
+
+/*
+ * Writes a run of printable ASCII characters. This is the same as calling
+ * tputc() for each character, but the glyphs are stored a line at a time.
+ */
+void
+tputascii(const char *s, int n)
+{
+	int i, x, len;
+	uint32_t ftcs;
+	Line line;
+
+	if (IS_SET(MODE_PRINT))
+		tprinter((char *)s, n);
+
+	while (n > 0) {
+		if (term.c.state & CURSOR_WRAPNEXT) {
+			if (IS_SET(MODE_WRAP)) {
+				term.line[term.c.y][term.col-1].mode |= ATTR_WRAP;
+				tnewline(1);
+			} else if (term.c.x == term.col - 1) {
+				/* only the last character stays at the right margin */
+				s += n - 1;
+				n = 1;
+			}
+		}
+
+		x = term.c.x;
+		len = MIN(n, term.col - x);
+		line = term.line[term.c.y];
+
+		/* selected() takes relative coordinates */
+		if (regionselected(x, term.c.y + term.scr, x + len - 1, term.c.y + term.scr))
+			selclear();
+
+		if ((line[x].mode & ATTR_WDUMMY) && x > 0) {
+			line[x-1].u = ' ';
+			line[x-1].mode &= ~ATTR_WIDE;
+		}
+		if ((line[x+len-1].mode & ATTR_WIDE) && x+len < term.col) {
+			line[x+len].u = ' ';
+			line[x+len].mode &= ~ATTR_WDUMMY;
+		}
+
+		for (i = 0; i < len; i++) {
+			ftcs = line[x+i].extra & (EXT_FTCS_PROMPT1_START | EXT_FTCS_PROMPT1_INPUT);
+			line[x+i] = term.c.attr;
+			line[x+i].u = (uchar)s[i];
+			line[x+i].mode |= ATTR_SET;
+			line[x+i].extra |= ftcs;
+		}
+		tsetdirtspan(term.c.y, MAX(x-1, 0), MIN(x+len+1, term.col));
+		term.lastc = (uchar)s[len-1];
+		s += len;
+		n -= len;
+
+		if (x + len < term.col) {
+			tmoveto(x + len, term.c.y);
+		} else {
+			term.c.x = term.col - 1;
+			term.wrapcwidth[IS_SET(MODE_ALTSCREEN)] = 1;
+			term.c.state |= CURSOR_WRAPNEXT;
+		}
+	}
+}
+
 int
 twrite(const char *buf, int buflen, int show_ctrl)
 {
 	int charsize;
-	Rune u;
-	int n;
+	Rune u, *runes;
+	int i, n, nrunes;
 
 	int su0 = su;
 	twrite_aborted = 0;
@@ -3555,6 +4232,48 @@ twrite(const char *buf, int buflen, int show_ctrl)
 		if (IS_SET(MODE_SIXEL) && sixel_st.state != PS_ESC) {
 			charsize = sixel_parser_parse(&sixel_st, (const unsigned char*)buf + n, buflen - n);
 			continue;
+		} else if (!term.esc && !IS_SET(MODE_INSERT) &&
+		           term.trantbl[term.charset] != CS_GRAPHIC0 &&
+		           (charsize = tprintablelen(buf + n, buflen - n)) > 0) {
+			/* fast path for plain text */
+			if (su0 && !su) {
+				twrite_aborted = 1;
+				break;
+			}
+			tputascii(buf + n, charsize);
+			continue;
+		} else if ((term.esc & (ESC_CSI|ESC_STR)) == ESC_CSI &&
+		           !IS_SET(MODE_PRINT) &&
+		           (charsize = csiwrite(buf + n, buflen - n)) > 0) {
+			/* fast path for the arguments of control sequences */
+			continue;
+		} else if (!term.esc && !show_ctrl && !IS_SET(MODE_PRINT) &&
+		           n + 1 < buflen && buf[n] == '\033' && buf[n+1] == '[') {
+			/* fast path for the start of control sequences, the same
+			 * as tputc() of ESC and '[' */
+			if (su0 && !su) {
+				twrite_aborted = 1;
+				break;
+			}
+			csireset();
+			term.esc = ESC_START|ESC_CSI;
+			charsize = 2 + csiwrite(buf + n + 2, buflen - n - 2);
+			continue;
+		} else if (IS_SET(MODE_UTF8) &&
+		           (nrunes = tdecoderun(buf + n, buflen - n, &runes)) > 0) {
+			/* fast path for non-ASCII text */
+			if (su0 && !su) {
+				twrite_aborted = 1;
+				break;
+			}
+			for (charsize = i = 0; i < nrunes; i++) {
+				tputc(runes[i]);
+				charsize += (runes[i] < 0x800) ? 2 : (runes[i] < 0x10000) ? 3 : 4;
+				/* the rest is written rune by rune if a sequence ended */
+				if ((su0 && !su) || !IS_SET(MODE_UTF8))
+					break;
+			}
+			continue;
 		} else if (IS_SET(MODE_UTF8)) {
 			/* process a complete utf8 char */
 			charsize = utf8decode(buf + n, &u, buflen - n);
@@ -3580,6 +4299,7 @@ twrite(const char *buf, int buflen, int show_ctrl)
 		}
 		tputc(u);
 	}
+	stats.n[STATS_BYTES] += n;
 	return n;
 }
 
@@ -3594,33 +4314,111 @@ treflow_moveimages(int oldy, int newy)
 	}
 }
 
+/* reads the history line y in the width it was written */
+Line
+treflow_histline(int y, int *width)
+{
+	static Glyph *buf;
+	static int bufcol;
+
+	if ((*width = histlinewidth(y)) > bufcol)
+		buf = xrealloc(buf, (bufcol = *width) * sizeof(Glyph));
+	loadhistline(y, buf, *width);
+	return buf;
+}
+
+/* same as tlinelen() on the main screen, but for any width */
+int
+treflow_linelen(Line line, int width)
+{
+	int i = width - 1;
+
+	for (; i >= 0 && !(line[i].mode & (ATTR_SET | ATTR_WRAP)); i--);
+
+	return i + 1;
+}
+
 void
-treflow(int col, int row)
+treflow(int col, int row, int hist)
 {
-	int i, j;
-	int oce, nce, bot, scr;
-	int ox = 0, oy = -term.histf, nx = 0, ny = -1, len;
+	int i, j, k, w, defer = deferreflow && row <= term.row && !hist && !term.scr;
+	int oce, nce, bot, scr, oscr = term.scr;
+	int ox = 0, oy, nx = 0, ny = -1, len;
 	int cy = -1; /* proxy for new y coordinate of cursor */
-	int buflen, nlines;
-	Line *buf, bufline, line;
+	int buflen, bufrows, nlines;
+	Glyph *buf;
+	Line bufline, line;
 	ImageList *im, *next;
 
 	/* unset reflow_y in images */
 	for (im = term.images; im; im = im->next)
 		im->reflow_y = INT_MIN;
 
-	/* y coordinate of cursor line end */
-	for (oce = term.c.y; oce < term.row - 1 &&
-	                     tiswrapped(term.line[oce]); oce++);
-
+	/* y coordinate of cursor line end, or of the history end if the
+	 * history alone is reflowed */
+	if (hist)
+		oce = -1;
+	else
+		for (oce = term.c.y; oce < term.row - 1 &&
+		                     tiswrapped(term.line[oce]); oce++);
+
+	/* Only the newest history lines that may end up on the screen are
+	 * reflowed, or the newest hist lines if the history alone is. The
+	 * older lines keep their width until they are read, see
+	 * treflowhistory(). A deferred reflow leaves the history alone, the
+	 * skipped lines are reflowed later. */
+	packhistory(0);
+	term.histcol = col;
+	if (defer) {
+		reflowcol = reflowcol ? reflowcol : term.col;
+		k = 0;
+	} else if (hist) {
+		k = MIN(term.histf, hist);
+	} else {
+		k = MIN(term.histf, (row + term.scr) * DIVCEIL(col, reflowcol ?
+		        MIN(reflowcol, term.col) : term.col) + reflowrows);
+		reflowcol = reflowrows = 0;
+	}
+	/* start from the beginning of a wrapped line, and take the narrower
+	 * lines that the previous resizes left behind */
+	for (j = 0; !defer && k < term.histf && j < MIN_HISTSIZE; k++, j++) {
+		line = treflow_histline(-k - 1, &w);
+		len = treflow_linelen(line, w);
+		if (w >= col && (len == 0 || !(line[len - 1].mode & ATTR_WRAP)))
+			break;
+	}
+	oy = -k;
+	/* the older lines keep their place, after a resize they are all stale */
+	if (!hist)
+		reflowold = 0;
+	reflowstale = term.histf - k - reflowold;
+	if (reflowstale <= 0)
+		reflowold = reflowstale = 0;
+
+	/* the reflowed lines are stored in a ring buffer that grows as needed */
 	nlines = term.histlimit + row;
-	buf = xmalloc(nlines * sizeof(Line));
+	bufrows = MIN(k + term.row + row, nlines);
+	buf = xmalloc(bufrows * col * sizeof(Glyph));
 	do {
-		if (!nx && ++ny < nlines)
-			buf[ny] = xmalloc(col * sizeof(Glyph));
+		if (!nx && ++ny >= bufrows && bufrows < nlines) {
+			bufrows = MIN(bufrows * 2, nlines);
+			buf = xrealloc(buf, bufrows * col * sizeof(Glyph));
+		}
 		if (!ox) {
-			line = TLINEABS(oy);
-			len = tlinelen(line);
+			if (oy < 0)
+				line = treflow_histline(oy, &w);
+			else
+				line = term.line[oy], w = term.col;
+			len = treflow_linelen(line, w);
+		}
+		/* the history lines as wide as the screen are kept as they are,
+		 * unless they wrap early and must be joined with the next one */
+		if (!ox && !nx && oy < 0 && w == col && (len == col || len == 0 ||
+		    !(line[len - 1].mode & ATTR_WRAP))) {
+			memcpy(&buf[ny % nlines * col], line, col * sizeof(Glyph));
+			treflow_moveimages(oy+term.scr, ny);
+			oy++;
+			continue;
 		}
 		if (oy == term.c.y) {
 			if (!ox)
@@ -3632,7 +4430,7 @@ treflow(int col, int row)
 			}
 		}
 		/* get reflowed lines in buf */
-		bufline = buf[ny % nlines];
+		bufline = &buf[ny % nlines * col];
 		if (col - nx > len - ox) {
 			memcpy(&bufline[nx], &line[ox], (len-ox) * sizeof(Glyph));
 			nx += len - ox;
@@ -3667,39 +4465,45 @@ treflow(int col, int row)
 		for (j = nx; j < col; j++)
 			tclearglyph(&bufline[j], 0);
 
+	/* drop the reflowed history lines, the older lines are kept */
+	if (k > 0) {
+		term.histf -= k;
+		/* the ring must not wrap while it can still grow */
+		term.histi = term.histf ? (term.histi - k + term.histsize) % term.histsize : -1;
+	}
+
+	buflen = MIN(ny + 1, nlines);
+	/* the screen is left as it is when the history alone is reflowed */
+	if (hist)
+		goto history;
+
 	/* free extra lines */
+	tlinelinear();
 	for (i = row; i < term.row; i++)
 		free(term.line[i]);
 	/* resize to new height */
-	term.line = xrealloc(term.line, row * sizeof(Line));
+	term.line = xrealloc(term.line, 2 * row * sizeof(Line));
 
-	/* free old history */
-	if (term.histlimit > 0) {
-		for (i = 0; i < term.histsize; i++)
-			free(term.hist[i]);
-		free(term.hist);
-		term.hist = NULL;
-		term.histf = 0;
-		term.histi = -1;
-		term.histsize = 0;
-	}
-
-	buflen = MIN(ny + 1, nlines);
 	bot = MIN(ny, row - 1);
 	scr = MAX(row - term.row, 0);
 	/* update y coordinate of cursor line end */
-	nce = MIN(oce + scr, bot);
+	nce = MIN(oce + scr + (defer ? 0 : reflowfreed), bot);
 	/* update cursor y coordinate */
 	term.c.y = nce - (ny - cy);
 	if (term.c.y < 0) {
 		j = nce, nce = MIN(nce + -term.c.y, bot);
 		term.c.y += nce - j;
 		while (term.c.y < 0) {
-			free(buf[ny-- % nlines]);
+			ny--;
 			buflen--;
 			term.c.y++;
 		}
 	}
+	/* without the history, a wider screen has no lines to pull down */
+	if (defer)
+		reflowfreed = MAX(reflowfreed + MIN(oce + scr, row - 1) - nce, 0);
+	else
+		reflowfreed = 0;
 	/* allocate new rows */
 	for (i = row - 1; i > nce; i--) {
 		if (i >= term.row)
@@ -3710,37 +4514,45 @@ treflow(int col, int row)
 			tclearglyph(&term.line[i][j], 0);
 	}
 	/* fill visible area */
-	for (/*i = nce */; i >= term.row; i--, ny--, buflen--)
-		term.line[i] = buf[ny % nlines];
-	for (/*i = term.row - 1 */; i >= 0; i--, ny--, buflen--) {
-		free(term.line[i]);
-		term.line[i] = buf[ny % nlines];
+	for (/*i = nce */; i >= 0; i--, ny--, buflen--) {
+		if (i >= term.row)
+			term.line[i] = xmalloc(col * sizeof(Glyph));
+		else
+			term.line[i] = xrealloc(term.line[i], col * sizeof(Glyph));
+		memcpy(term.line[i], &buf[ny % nlines * col], col * sizeof(Glyph));
 	}
-	/* fill lines in history buffer */
+	tlinemirror(row);
+history:
+	/* append the reflowed lines to the history */
+	j = 0;
 	if (term.histlimit > 0) {
-		if (buflen > 0) {
-			term.histsize = MIN(buflen, term.histlimit);
-			term.hist = xmalloc(term.histsize * sizeof(*term.hist));
-			for (i = term.histsize-1; i >= 0; i--, ny--, buflen--)
-				term.hist[i] = buf[ny % nlines];
-			term.histf = term.histsize;
-			term.histi = term.histsize-1;
-		} else {
-			increasehistorysize(MIN_HISTSIZE, col);
+		j = MAX(MIN(buflen, term.histlimit), 0);
+		increasehistorysize(term.histf + j, col);
+		for (i = j; i > 0; i--) {
+			term.histi = (term.histi + 1) % term.histsize;
+			storehistline(-1, &buf[(ny - i + 1) % nlines * col], col);
 		}
+		treflowdrop(term.histf + j - term.histsize);
+		term.histf = MIN(term.histf + j, term.histsize);
 		term.scr = MIN(term.scr, term.histf);
 	}
+	if (defer)
+		reflowrows += j;
 
 	/* move images to the final position */
 	for (im = term.images; im; im = next) {
 		next = im->next;
-		if (im->reflow_y == INT_MIN) {
+		if (im->reflow_y != INT_MIN)
+			im->y = im->reflow_y - (ny + 1) + term.scr;
+		else if (im->y - oscr < -k)
+			im->y += k - j - oscr + term.scr;
+		else if (hist)
+			im->y += term.scr - oscr;
+		else
+			im->y = INT_MIN;
+		if (im->y == INT_MIN || im->y - term.scr < -term.histf ||
+		    im->y - term.scr >= row)
 			delete_image(im);
-		} else {
-			im->y = im->reflow_y - term.histf + term.scr - (ny + 1);
-			if (im->y - term.scr < -term.histsize || im->y - term.scr >= row)
-				delete_image(im);
-		}
 	}
 
 	/* expand images into new text cells */
@@ -3753,9 +4565,6 @@ treflow(int col, int row)
 		}
 	}
 
-	/* free lines that didn't fit in history buffer */
-	for (; buflen > 0; ny--, buflen--)
-		free(buf[ny % nlines]);
 	free(buf);
 }
 
@@ -3772,15 +4581,14 @@ rscrolldown(int n)
 	if ((n = MIN(n, term.histf)) <= 0)
 		return;
 
+	/* called by tresizedef() before the line buffer is mirrored again */
 	for (i = term.c.y + n; i >= n; i--) {
 		temp = term.line[i];
 		term.line[i] = term.line[i-n];
 		term.line[i-n] = temp;
 	}
 	for (/*i = n - 1 */; i >= 0; i--) {
-		temp = term.line[i];
-		term.line[i] = term.hist[term.histi];
-		term.hist[term.histi] = temp;
+		loadhistline(-1, term.line[i], term.col);
 		term.histi = (term.histi - 1 + term.histsize) % term.histsize;
 	}
 	term.c.y += n;
@@ -3812,6 +4620,7 @@ tresize(int col, int row)
 		win.mode ^= kbds_keyboardhandler(XK_Escape, NULL, 0, 1);
 
 	term.dirty = xrealloc(term.dirty, row * sizeof(*term.dirty));
+	term.dirtyx = xrealloc(term.dirtyx, row * sizeof(*term.dirtyx));
 	term.dirtyimg = xrealloc(term.dirtyimg, row * sizeof(*term.dirtyimg));
 	term.tabs = xrealloc(term.tabs, col * sizeof(*term.tabs));
 	if (col > term.col) {
@@ -3829,6 +4638,170 @@ tresize(int col, int row)
 		tresizedef(col, row);
 }
 
+/*
+ * While set, the resizes reflow only the screen, and the history lines
+ * are reflowed when it is unset again. An interactive resize does not
+ * have to reflow the history on every step.
+ */
+void
+tdeferreflow(int set)
+{
+	deferreflow = set;
+	if (!set)
+		treflowdeferred();
+}
+
+/* reflows the history lines that were skipped by the deferred resizes and
+ * refills the screen rows that they freed */
+void
+treflowdeferred(void)
+{
+	int defer = deferreflow;
+
+	if ((!reflowcol && !reflowfreed) || IS_SET(MODE_ALTSCREEN))
+		return;
+	win.mode ^= kbds_keyboardhandler(XK_Escape, NULL, 0, 1);
+	if (!sel.alt)
+		selremove();
+	deferreflow = 0;
+	treflow(term.col, term.row, 0);
+	deferreflow = defer;
+	tfulldirt();
+}
+
+/*
+ * reflows the newest n history lines, if the resizes left some of them at
+ * their old width. It is called before the lines are read, as the older
+ * lines are only reflowed on demand. The lines already reflowed are moved
+ * along, so at least twice as many are taken each time, and scrolling
+ * through the whole history costs about as much as one full reflow. The
+ * screen is not changed.
+ */
+void
+treflowhistory(int n)
+{
+	int done = term.histf - reflowold - reflowstale;
+
+	if (!reflowstale || n <= done || IS_SET(MODE_ALTSCREEN))
+		return;
+	treflow(term.col, term.row, MAX(n + term.row, 2 * done));
+	tfulldirt();
+}
+
+/*
+ * Makes room at the start of the full history before its oldest line is
+ * overwritten. The stale lines after the ones reflowed last time are
+ * reflowed, as a line written on a narrower screen takes fewer lines now,
+ * and the lines reflowed so far are moved to the freed slots. At least as
+ * many slots are freed as there are lines to move, so the moves cost no
+ * more than the new lines that fill the slots. This way the stale lines
+ * do not push older lines out while they take more slots than they would
+ * after a full reflow. A line written on a wider screen takes more lines
+ * instead, and the oldest lines are dropped first.
+ */
+void
+treflowoldest(void)
+{
+	int i, x, w, len, l, k, d, col = term.col;
+	int y = -term.histf, o = reflowold, s = o, n = 0, nx = 0, rows = 16;
+	int lim = MIN(reflowstale, MIN_HISTSIZE + 2 * o);
+	Glyph *buf, *g;
+	Line line;
+	ImageList *im, *next;
+
+	for (im = term.images; im; im = im->next)
+		im->reflow_y = INT_MIN;
+
+	/* the stale lines s and up, reflowed to n lines in buf */
+	buf = xmalloc(rows * col * sizeof(Glyph));
+	while (s - o < lim && s - o - n < MAX(o, 1)) {
+		l = s, k = n;
+		/* the last line may go on in the lines reflowed already */
+		do {
+			line = treflow_histline(y + s, &w);
+			len = treflow_linelen(line, w);
+			treflow_moveimages(y + s + term.scr, n);
+			s++;
+			for (x = 0; x < len; x++) {
+				/* a wide glyph that does not fit goes to the next line */
+				if (nx == col || (nx == col - 1 && (line[x].mode & ATTR_WIDE))) {
+					g = &buf[n * col];
+					g[nx - 1].mode |= ATTR_WRAP;
+					for (i = nx; i < col; i++)
+						tclearglyph(&g[i], 0);
+					if (++n == rows)
+						buf = xrealloc(buf, (rows *= 2) * col * sizeof(Glyph));
+					nx = 0;
+				}
+				g = &buf[n * col + nx++];
+				*g = line[x];
+				g->mode &= ~ATTR_WRAP;
+			}
+		} while (len > 0 && (line[len - 1].mode & ATTR_WRAP) &&
+		         s < term.histf && s - l < MIN_HISTSIZE);
+		/* a line longer than the limit is continued by the next one */
+		g = &buf[n * col];
+		if (len > 0 && (line[len - 1].mode & ATTR_WRAP))
+			g[nx - 1].mode |= ATTR_WRAP;
+		for (i = nx; i < col; i++)
+			tclearglyph(&g[i], 0);
+		if (++n == rows)
+			buf = xrealloc(buf, (rows *= 2) * col * sizeof(Glyph));
+		nx = 0;
+		/* a line written on a wider screen frees nothing */
+		if (n - k > s - l)
+			break;
+	}
+
+	/* move the lines reflowed before by the d freed slots, the newest
+	 * lines of buf go after them */
+	d = s - o - n;
+	if (d > 0) {
+		for (i = o - 1; i >= 0; i--) {
+			line = treflow_histline(y + i, &w);
+			storehistline(y + i + d, line, w);
+		}
+	} else {
+		for (i = -d; i < o; i++) {
+			line = treflow_histline(y + i, &w);
+			storehistline(y + i + d, line, w);
+		}
+	}
+	for (i = MAX(n - s, 0); i < n; i++)
+		storehistline(y + s - n + i, &buf[i * col], col);
+	free(buf);
+
+	for (im = term.images; im; im = next) {
+		next = im->next;
+		if (im->reflow_y != INT_MIN)
+			im->y = y + s - n + im->reflow_y + term.scr;
+		else if (im->y - term.scr >= y && im->y - term.scr < y + o)
+			im->y += d;
+		else
+			continue;
+		if (im->y - term.scr < y + MAX(d, 0))
+			delete_image(im);
+	}
+
+	term.histf -= MAX(d, 0);
+	reflowold = MIN(o + n, s);
+	if ((reflowstale -= s - o) <= 0)
+		reflowold = reflowstale = 0;
+}
+
+/* forgets the n oldest history lines, they were overwritten */
+void
+treflowdrop(int n)
+{
+	int i = MIN(n, reflowold);
+
+	if (n <= 0)
+		return;
+	reflowold -= i;
+	if ((reflowstale -= n - i) <= 0)
+		reflowold = reflowstale = 0;
+}
+
 void
 tresizedef(int col, int row)
 {
@@ -3842,18 +4815,24 @@ tresizedef(int col, int row)
 	if (col != term.col) {
 		if (!sel.alt)
 			selremove();
-		treflow(col, row);
+		treflow(col, row, 0);
 	} else {
+		/* the history lines pulled to the screen must be reflowed */
+		if (row > term.row) {
+			treflowdeferred();
+			treflowhistory(row - term.row);
+		}
 		/* slide screen up if otherwise cursor would get out of the screen */
 		if (term.c.y >= row) {
 			tscrollup(0, term.row - 1, term.c.y - row + 1, SCROLL_RESIZE);
 			term.c.y = row - 1;
 		}
+		tlinelinear();
 		for (i = row; i < term.row; i++)
 			free(term.line[i]);
 
 		/* resize to new height */
-		term.line = xrealloc(term.line, row * sizeof(Line));
+		term.line = xrealloc(term.line, 2 * row * sizeof(Line));
 		/* allocate any new rows */
 		for (i = term.row; i < row; i++) {
 			term.line[i] = xmalloc(col * sizeof(Glyph));
@@ -3862,6 +4841,7 @@ tresizedef(int col, int row)
 		}
 		/* scroll down as much as height has increased */
 		rscrolldown(row - term.row);
+		tlinemirror(row);
 	}
 	/* update terminal size */
 	term.col = col, term.row = row;
@@ -3885,6 +4865,7 @@ tresizealt(int col, int row)
 	if (sel.alt)
 		selremove();
 	/* slide screen up if otherwise cursor would get out of the screen */
+	tlinelinear();
 	for (i = 0; i <= term.c.y - row; i++)
 		free(term.line[i]);
 	if (i > 0) {
@@ -3896,7 +4877,7 @@ tresizealt(int col, int row)
 	for (i += row; i < term.row; i++)
 		free(term.line[i]);
 	/* resize to new height */
-	term.line = xrealloc(term.line, row * sizeof(Line));
+	term.line = xrealloc(term.line, 2 * row * sizeof(Line));
 	/* resize to new width */
 	for (i = 0; i < MIN(row, term.row); i++) {
 		term.line[i] = xrealloc(term.line[i], col * sizeof(Glyph));
@@ -3909,6 +4890,7 @@ tresizealt(int col, int row)
 		for (j = 0; j < col; j++)
 			tclearglyph(&term.line[i][j], 0);
 	}
+	tlinemirror(row);
 	/* update cursor */
 	if (term.c.x >= col) {
 		term.c.state &= ~CURSOR_WRAPNEXT;
@@ -3945,15 +4927,19 @@ resettitle(void)
 void
 drawregion(int x1, int y1, int x2, int y2)
 {
-	int y;
+	int y, a, b;
+	Line line;
 
 	for (y = y1; y < y2; y++) {
 		if (!term.dirty[y])
 			continue;
 
-		term.dirty[y] = 0;
-		xdrawline(TLINE(y), x1, y, x2);
+		line = TLINE(y);
+		tdirtyspan(line, y, &a, &b);
+		xdrawline(line, MAX(a, x1), y, MIN(b, x2));
+		stats.n[STATS_LINES]++;
 	}
+	xflushlines();
 }
 
 #include "patch/st_include.c"
@@ -3974,21 +4960,40 @@ draw(void)
 	if (term.line[term.c.y][cx].mode & ATTR_WDUMMY)
 		cx--;
 
+	/* move the scrolled lines instead of redrawing them */
+	if (term.blitn) {
+		if (!xscroll(term.blittop, term.blitbot, term.blitn)) {
+			tsetdirt(term.blittop, term.blitbot);
+		} else if (BETWEEN(term.ocy, term.blittop, term.blitbot) &&
+		           BETWEEN(term.ocy - term.blitn, term.blittop, term.blitbot)) {
+			/* the old cursor was moved too */
+			tsetdirtspan(term.ocy - term.blitn, term.ocx, MIN(term.ocx + 2, term.col));
+		}
+		term.blitn = 0;
+	}
+
 	if (!kbds_drawcursor()) {
 		xdrawcursor(cx, term.c.y, term.line[term.c.y][cx],
 		            term.ocx, term.ocy, term.line[term.ocy]);
 	}
+	statsstart(STATS_DRAW);
 	drawregion(0, 0, term.col, term.row);
 	drawhyperlinkhint();
+	statsstop(STATS_DRAW);
 
 	term.ocx = cx;
 	term.ocy = term.c.y;
+	statsstart(STATS_FINISH);
 	xfinishdraw();
+	statsstop(STATS_FINISH);
 
-	if (kbds_getcursor(&cx, &cy))
+	if (kbds_getcursor(&cx, &cy)) {
 		xximspot(cx, cy);
-	else
+	} else {
 		xximspot(term.ocx, term.ocy);
+		/* keyboard select is the only one that keeps history lines */
+		packhistory(1);
+	}
 }
 
 void
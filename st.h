@@ -149,7 +149,6 @@ typedef XftGlyphFontSpec GlyphFontSpec;
 #define Glyph Glyph_
 typedef struct {
 	Rune u;           /* character code */
-	Rune ubk;         /* character code for flash label */
 	Mode mode;        /* attribute flags */
 	ushort hlink;     /* hyperlink index */
 	uint32_t fg;      /* foreground  */
@@ -159,6 +158,44 @@ typedef struct {
 
 typedef Glyph *Line;
 
+/* packed history cell, the colors are kept in the style table of the line */
+typedef struct {
+	Rune u;           /* character code */
+	Mode mode;        /* attribute flags */
+	ushort style;     /* index in the style table */
+} HistCell;
+
+typedef struct {
+	uint32_t fg;
+	uint32_t bg;
+	uint32_t extra;
+	ushort hlink;
+} HistStyle;
+
+typedef struct {
+	int style;        /* index of the first style in the chunk */
+	ushort nstyles;   /* nb styles, 0 if the line is unused */
+	ushort width;     /* width of the screen the line was written on */
+} HistLine;
+
+/*
+ * history chunk, either compressed, packed or unpacked while it is in use.
+ * Only one of glyphs, cells and zdata is set at a time.
+ */
+typedef struct {
+	Glyph *glyphs;     /* unpacked lines */
+	HistCell *cells;   /* packed lines */
+	HistLine *lines;   /* kept while the chunk is unpacked */
+	HistStyle *styles;
+	int col;           /* nb cells in a line */
+	int nstyles;       /* nb styles in use, including the unreferenced */
+	int livestyles;    /* nb styles referenced by the lines */
+	int stylesize;     /* allocated size of styles */
+	uchar *zdata;      /* compressed lines */
+	int zlen;          /* size of zdata */
+	int rawlen;        /* size of the lines before compression */
+} HistChunk;
+
 typedef struct {
 	int x;
 	int charlen;
@@ -197,14 +234,19 @@ typedef struct {
 	int row;      /* nb row */
 	int col;      /* nb col */
 	Line *line;   /* screen */
-	Line *hist;          /* history buffer */
+	int linebase; /* offset of the screen in the mirrored line buffer */
+	HistChunk *hist;     /* history buffer chunks */
+	int histcol;         /* min width of unpacked history lines */
 	int histlimit;       /* max history size */
 	int histsize;        /* current history size */
 	int histf;           /* nb history available */
 	int histi;           /* history index */
 	int scr;             /* scroll back */
 	int wrapcwidth[2];   /* used in updating WRAPNEXT when resizing */
-	int *dirty;     /* dirtyness of lines */
+	int blittop, blitbot; /* scrolling region of the pending blit */
+	int blitn;           /* nb lines the region is scrolled up */
+	int *dirty;     /* dirtyness of lines: 0 clean, 1 whole line, 2 dirtyx */
+	int (*dirtyx)[2]; /* dirty columns x1 to x2-1 of the lines */
 	char *dirtyimg; /* dirtyness of image lines */
 	TCursor c;    /* cursor */
 	int ocx;      /* old cursor col */
@@ -341,6 +383,8 @@ void redraw(void);
 void draw(void);
 void drawregion(int, int, int, int);
 void tfulldirt(void);
+void tsetdirtspan(int, int, int);
+void tdirtyspan(Line, int, int *, int *);
 
 void printscreen(const Arg *);
 void printsel(const Arg *);
@@ -352,10 +396,14 @@ int tisaltscr(void);
 void tsethold(int);
 void tnew(int, int);
 void tresize(int, int);
+void tdeferreflow(int);
+void treflowhistory(int);
 void tsetdirtattr(int);
+void tflushsgrcache(void);
 void ttyhangup(void);
 int ttynew(const char *, char *, const char *, char **);
-size_t ttyread(void);
+size_t ttyread(double);
+int twrite(const char *, int, int);
 void ttyresize(int, int);
 void ttywrite(const char *, size_t, int);
 
@@ -418,4 +466,6 @@ extern XSelection xsel;
 extern TermWindow win;
 extern Term term;
 extern unsigned int disablehyperlinks;
+extern unsigned int scrollbackhotlines;
+extern char *scrollbackdir;
 extern int undercurl_style;
@@ -29,6 +29,8 @@ void xbell(void);
 void xclipcopy(void);
 void xdrawcursor(int, int, Glyph, int, int, Line);
 void xdrawline(Line, int, int, int);
+void xflushlines(void);
+int xscroll(int, int, int);
 void xfinishdraw(void);
 void xloadcols(void);
 int xsetcolorname(int, const char *);
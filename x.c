@@ -68,15 +68,22 @@ uint hbfeaturecount = sizeof(hbfeatures) / sizeof(hb_feature_t);
 #define TRUEBLUE(x)		(((x) & 0xff) << 8)
 
 static inline ushort sixd_to_16bit(int);
+static void rfmaprehash(int, int);
+static void rfmapput(Rune, int, int, FT_UInt);
+static FcPattern *xfallbackquery(FcPattern *, Rune);
+static FcPattern *xmatchfallbackfont(FcPattern *, FcFontSet *, Rune);
+static int xaddfallbackfont(FcPattern *, int);
+static XftFont *xfallbackfont(Font *, int, Rune, FT_UInt *);
 #if !DISABLE_LIGATURES
 static inline void xresetfontsettings(Mode mode, Font **font, int *frcflags);
 static int xmakeglyphfontspecs_ligatures(XftGlyphFontSpec *, const Glyph *, int, int, int);
-static inline void xdrawline_ligatures(Line, int, int, int);
+static inline int xdrawline_ligatures(Line, int, int, int);
 #endif
 static int xmakeglyphfontspecs_noligatures(GlyphFontSeq *, XftGlyphFontSpec *, const Glyph *, int, int, int);
-static inline void xdrawline_noligatures(Line, int, int, int);
+static inline int xdrawline_noligatures(Line, int, int, int);
 static void xdrawglyphfontspecs(const XftGlyphFontSpec *, GlyphFontSeq *, int, int);
 static void xclear(int, int, int, int);
+static void xfillrect(Color *, int, int, int, int);
 static int xgeommasktogravity(int);
 static int ximopen(Display *);
 static void ximinstantiate(Display *, XPointer, XPointer);
@@ -94,6 +101,7 @@ static void xunloadfont(Font *);
 static void xunloadfonts(void);
 static void xsetenv(void);
 static void xseturgency(int);
+static void xalloccolor(const XRenderColor *, Color *);
 static inline void lerpvisualbellcolor(Color *, Color *);
 static void drawscrollbackindicator(void);
 static int drawunderline(Glyph *, Color *, int, int, int, int, int);
@@ -170,11 +178,45 @@ enum {
 };
 
 typedef struct {
-	XftFont *font;
+	XftFont *font;         /* NULL if the entry is free */
 	int flags;
-	Rune unicodep;
+	int spare;             /* spare fonts are never closed */
+	int refs;              /* nb runes mapped to the font */
+	unsigned long lastuse; /* frame the font was last used in */
 } Fontcache;
 
+/* maps a rune and a style to the fallback font and the glyph in it */
+typedef struct {
+	Rune rune;
+	int flags;
+	int font;      /* index in frc + 1, 0 if free, -1 if being looked up */
+	FT_UInt glyph; /* 0 if no font has the glyph */
+} Runefont;
+
+/* the background rectangles of a color, see xfillrect() */
+typedef struct {
+	Color color;
+	XRectangle *rects;
+	int len, cap;
+} FillBatch;
+
+/* a line whose text is drawn after the backgrounds, see xflushlines() */
+typedef struct {
+	int x1, y, x2;
+	int seq, numseqs;  /* the sequences of the line in linebatch.seq */
+	int specs;         /* the first glyph of the line in linebatch.specs */
+} BatchLine;
+
+/* a color allocated while drawing, see xalloccolor() */
+#define COLORCACHE_SETS 256
+#define COLORCACHE_WAYS 4
+
+typedef struct {
+	uint64_t key;           /* the 16-bit channels of the color */
+	unsigned long lastuse;  /* 0 if the entry is free */
+	Color color;
+} ColorCacheEntry;
+
 typedef enum {
 	SCROLL_UP,
 	SCROLL_DOWN,
@@ -205,6 +247,25 @@ struct {
 static Fontcache *frc = NULL;
 static int frclen = 0;
 static int frccap = 0;
+static unsigned long frcframe;
+/* max nb fallback fonts kept open, the fonts of the frame are always kept */
+#define FRC_MAXFONTS 32
+static ColorCacheEntry colorcache[COLORCACHE_SETS][COLORCACHE_WAYS];
+static FillBatch *fills = NULL;
+static int fillslen = 0;
+static int fillscap = 0;
+static struct {
+	GlyphFontSeq *seq;
+	GlyphFontSpec *specs;
+	BatchLine *lines;
+	int nseq, nspecs, nlines;
+	int seqcap, specscap, linescap;
+} linebatch;
+static unsigned long colorclock;
+static Runefont *rfmap = NULL;
+static int rfmaplen = 0;
+static int rfmapcap = 0;
+static Runefont *rfmapfind(Rune, int);
 static char *usedfont = NULL;
 static double usedfontsize = 0;
 static double defaultfontsize = 0;
@@ -343,7 +404,6 @@ void
 scrolltoprompt(const Arg *arg)
 {
 	int x, y;
-	int top = term.scr - term.histf;
 	int bot = term.scr + term.row-1;
 	int dy = arg->i;
 	Line line;
@@ -351,7 +411,9 @@ scrolltoprompt(const Arg *arg)
 	if (!dy || tisaltscr())
 		return;
 
-	for (y = dy; y >= top && y <= bot; y += dy) {
+	for (y = dy; y >= term.scr - term.histf && y <= bot; y += dy) {
+		/* the history is reflowed as far as it is searched */
+		treflowhistory(term.scr - y);
 		for (line = TLINE(y), x = 0; x < term.col; x++) {
 			if (line[x].extra & EXT_FTCS_PROMPT1_START)
 				goto scroll;
@@ -365,6 +427,37 @@ scroll:
 		kscrolldown(&((Arg){ .i = y }));
 }
 
+/*
+ * allocates a color for drawing. The colors are cached, so that the same
+ * true colors don't have to be allocated again on every redraw. The
+ * evicted colors are not freed, as they may still be on the screen.
+ */
+void
+xalloccolor(const XRenderColor *c, Color *result)
+{
+	uint64_t key = (uint64_t)c->red << 48 | (uint64_t)c->green << 32 |
+	               (uint64_t)c->blue << 16 | c->alpha;
+	ColorCacheEntry *set, *e, *victim;
+
+	set = colorcache[(key * 0x9e3779b97f4a7c15ull >> 32) % COLORCACHE_SETS];
+	for (victim = e = set; e < set + COLORCACHE_WAYS; e++) {
+		if (e->lastuse && e->key == key) {
+			e->lastuse = ++colorclock;
+			*result = e->color;
+			stats.n[STATS_COLORHITS]++;
+			return;
+		}
+		if (e->lastuse < victim->lastuse)
+			victim = e;
+	}
+
+	XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, c, &victim->color);
+	victim->key = key;
+	victim->lastuse = ++colorclock;
+	*result = victim->color;
+	stats.n[STATS_COLORS]++;
+}
+
 void
 lerpvisualbellcolor(Color *col, Color *result)
 {
@@ -376,7 +469,7 @@ lerpvisualbellcolor(Color *col, Color *result)
 	tmp.green = ILERP(bell->color.green, col->color.green, frame, frames);
 	tmp.blue =  ILERP(bell->color.blue,  col->color.blue,  frame, frames);
 	tmp.alpha = ILERP(bell->color.alpha, col->color.alpha, frame, frames);
-	XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &tmp, result);
+	xalloccolor(&tmp, result);
 }
 
 int
@@ -1032,7 +1125,54 @@ xclear(int x1, int y1, int x2, int y2)
 		bg = &bell;
 	}
 
-	XftDrawRect(xw.draw, bg, x1, y1, x2-x1, y2-y1);
+	xfillrect(bg, x1, y1, x2-x1, y2-y1);
+}
+
+/*
+ * fills the rectangle with the color. While the lines are drawn, the
+ * rectangles are gathered by color and filled in xflushlines().
+ */
+void
+xfillrect(Color *c, int x, int y, int w, int h)
+{
+	FillBatch *b;
+	XRectangle *r;
+
+	if (!linebatch.nlines) {
+		XftDrawRect(xw.draw, c, x, y, w, h);
+		return;
+	}
+	if (w <= 0 || h <= 0)
+		return;
+
+	for (b = fills; b < fills + fillslen; b++) {
+		if (!memcmp(&b->color.color, &c->color, sizeof(XRenderColor)))
+			break;
+	}
+	if (b == fills + fillslen) {
+		if (fillslen >= fillscap) {
+			fillscap = MAX(2 * fillscap, 16);
+			fills = xrealloc(fills, fillscap * sizeof(FillBatch));
+			memset(fills + fillslen, 0, (fillscap - fillslen) * sizeof(FillBatch));
+		}
+		b = &fills[fillslen++];
+		b->color = *c;
+		b->len = 0;
+	}
+
+	/* join the rectangle to the previous one of the same row */
+	if (b->len > 0) {
+		r = &b->rects[b->len-1];
+		if (r->y == y && r->height == h && r->x + r->width == x) {
+			r->width += w;
+			return;
+		}
+	}
+	if (b->len >= b->cap) {
+		b->cap = MAX(2 * b->cap, 64);
+		b->rects = xrealloc(b->rects, b->cap * sizeof(XRectangle));
+	}
+	b->rects[b->len++] = (XRectangle){ .x = x, .y = y, .width = w, .height = h };
 }
 
 void
@@ -1180,6 +1320,7 @@ xloadfont(Font *f, FcPattern *pattern)
 		return 1;
 
 	FcConfigSubstitute(NULL, configured, FcMatchPattern);
+	glyphcacheconfigure(configured);
 	XftDefaultSubstitute(xw.dpy, xw.scr, configured);
 
 	match = FcFontMatch(NULL, configured, &result);
@@ -1325,6 +1466,9 @@ xloadfonts(const char *fontstr, double fontsize)
 	FcPatternDestroy(boldpattern);
 	FcPatternDestroy(italicpattern);
 	FcPatternDestroy(bolditalicpattern);
+
+	fallbackcacheload();
+	glyphcacheprewarm(&dc.font);
 }
 
 void
@@ -1345,8 +1489,14 @@ xunloadfonts(void)
 	#endif
 
 	/* Free the loaded fonts in the font cache.  */
-	while (frclen > 0)
-		XftFontClose(xw.dpy, frc[--frclen].font);
+	while (frclen > 0) {
+		if (frc[--frclen].font)
+			XftFontClose(xw.dpy, frc[frclen].font);
+	}
+	/* the queued lookups are dropped, so are the runes waiting for them */
+	if (rfmapcap)
+		rfmaprehash(rfmapcap, 0);
+	fallbackreload();
 
 	xunloadfont(&dc.font);
 	xunloadfont(&dc.bfont);
@@ -1534,6 +1684,222 @@ xinit(int cols, int rows)
 		xsel.xtarget = XA_STRING;
 
 	boxdraw_xinit(xw.dpy, xw.cmap, xw.draw, xw.vis);
+	fallbackinit();
+}
+
+/*
+ * rebuilds the rune map with the given capacity and drops the closed
+ * fonts, and the pending lookups unless keeppending is set
+ */
+void
+rfmaprehash(int cap, int keeppending)
+{
+	Runefont *old = rfmap, *e;
+	int oldcap = rfmapcap;
+
+	rfmap = xmalloc(cap * sizeof(Runefont));
+	memset(rfmap, 0, cap * sizeof(Runefont));
+	rfmapcap = cap;
+	rfmaplen = 0;
+
+	for (e = old; e < old + oldcap; e++) {
+		if (!e->font || (e->font < 0 && !keeppending) ||
+		    (e->font > 0 && (e->font > frclen || !frc[e->font-1].font)))
+			continue;
+		*rfmapfind(e->rune, e->flags) = *e;
+		rfmaplen++;
+	}
+	free(old);
+}
+
+/* returns the slot of the rune in the map, or the free slot for it */
+Runefont *
+rfmapfind(Rune rune, int frcflags)
+{
+	int i;
+
+	for (i = (rune * 2654435761u ^ frcflags) & (rfmapcap-1); rfmap[i].font; i = (i+1) & (rfmapcap-1)) {
+		if (rfmap[i].rune == rune && rfmap[i].flags == frcflags)
+			break;
+	}
+	return &rfmap[i];
+}
+
+/* maps the rune to the font f, or to a pending lookup if f is -1 */
+void
+rfmapput(Rune rune, int frcflags, int f, FT_UInt glyph)
+{
+	Runefont *e;
+
+	if (2 * (rfmaplen + 1) > rfmapcap)
+		rfmaprehash(rfmapcap ? 2 * rfmapcap : 256, 1);
+	if (!(e = rfmapfind(rune, frcflags))->font)
+		rfmaplen++;
+	*e = (Runefont){ .rune = rune, .flags = frcflags, .font = f < 0 ? -1 : f+1, .glyph = glyph };
+	if (f >= 0) {
+		frc[f].refs++;
+		frc[f].lastuse = frcframe;
+	}
+}
+
+/* returns the pattern that the fallback font of the rune is matched with */
+FcPattern *
+xfallbackquery(FcPattern *pattern, Rune rune)
+{
+	FcPattern *fcpattern;
+	FcCharSet *fccharset;
+
+	fcpattern = FcPatternDuplicate(pattern);
+	fccharset = FcCharSetCreate();
+
+	FcCharSetAddChar(fccharset, rune);
+	FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
+	FcPatternAddBool(fcpattern, FC_SCALABLE, 1);
+
+	FcConfigSubstitute(0, fcpattern, FcMatchPattern);
+	FcDefaultSubstitute(fcpattern);
+
+	FcCharSetDestroy(fccharset);
+
+	return fcpattern;
+}
+
+/*
+ * returns the pattern of the fallback font for the rune. Only fontconfig
+ * is used, so it can be called from the fallback font thread too.
+ */
+FcPattern *
+xmatchfallbackfont(FcPattern *pattern, FcFontSet *set, Rune rune)
+{
+	FcResult fcres;
+	FcPattern *fcpattern, *fontpattern;
+	FcFontSet *fcsets[] = { set };
+
+	/*
+	 * Nothing was found in the cache. Now use
+	 * some dozen of Fontconfig calls to get the
+	 * font for one single character.
+	 *
+	 * Xft and fontconfig are design failures.
+	 */
+	fcpattern = xfallbackquery(pattern, rune);
+	fontpattern = FcFontSetMatch(0, fcsets, 1, fcpattern, &fcres);
+	FcPatternDestroy(fcpattern);
+
+	return fontpattern;
+}
+
+/* opens the matched fallback font and returns its index in the cache */
+int
+xaddfallbackfont(FcPattern *fontpattern, int frcflags)
+{
+	XftFont *xfont;
+	int f, lru, nfonts;
+
+	xfont = XftFontOpenPattern(xw.dpy, fontpattern);
+	if (!xfont)
+		die("XftFontOpenPattern failed seeking fallback font: %s\n",
+			strerror(errno));
+
+	/* Xft returns the same font for the same pattern, keep only one */
+	for (f = 0; f < frclen; f++) {
+		if (frc[f].font == xfont && frc[f].flags == frcflags) {
+			XftFontClose(xw.dpy, xfont);
+			return f;
+		}
+	}
+
+	/*
+	 * Close the least recently used fallback font when there are too
+	 * many of them. The fonts of the frame may still be in the specs.
+	 */
+	for (lru = -1, nfonts = 0, f = 0; f < frclen; f++) {
+		if (!frc[f].font || frc[f].spare)
+			continue;
+		nfonts++;
+		if (frc[f].lastuse != frcframe && (lru < 0 || frc[f].lastuse < frc[lru].lastuse))
+			lru = f;
+	}
+	if (nfonts >= FRC_MAXFONTS && lru >= 0) {
+		XftFontClose(xw.dpy, frc[lru].font);
+		frc[lru].font = NULL;
+		if (frc[lru].refs)
+			rfmaprehash(rfmapcap, 1);
+	}
+
+	for (f = 0; f < frclen && frc[f].font; f++)
+		;
+	if (f == frclen) {
+		/* Allocate memory for the new cache entry. */
+		if (frclen >= frccap) {
+			frccap += 16;
+			frc = xrealloc(frc, frccap * sizeof(Fontcache));
+		}
+		frclen++;
+	}
+	frc[f].font = xfont;
+	frc[f].flags = frcflags;
+	frc[f].spare = 0;
+	frc[f].refs = 0;
+	return f;
+}
+
+/* returns the fallback font of the rune and the glyph in it */
+XftFont *
+xfallbackfont(Font *font, int frcflags, Rune rune, FT_UInt *glyphidx)
+{
+	FcPattern *fontpattern;
+	FcResult fcres;
+	Runefont *e;
+	int f;
+
+	stats.n[STATS_FALLBACKS]++;
+	if (rfmapcap && (e = rfmapfind(rune, frcflags))->font) {
+		*glyphidx = e->glyph;
+		/* the glyph is missing until the font has been found */
+		if (e->font < 0)
+			return font->match;
+		frc[e->font-1].lastuse = frcframe;
+		return frc[e->font-1].font;
+	}
+
+	/* Search the open fonts for the glyph. */
+	for (f = 0; f < frclen; f++) {
+		if (!frc[f].font || frc[f].flags != frcflags)
+			continue;
+		if ((*glyphidx = XftCharIndex(xw.dpy, frc[f].font, rune)))
+			break;
+	}
+
+	/* Open the font that fontconfig found for the rune the last time. */
+	if (f >= frclen && (fontpattern = fallbackcachematch(font->pattern, frcflags, rune))) {
+		f = xaddfallbackfont(fontpattern, frcflags);
+		*glyphidx = XftCharIndex(xw.dpy, frc[f].font, rune);
+	}
+
+	/*
+	 * Nothing was found. Use fontconfig to find matching font. If the
+	 * font doesn't have the glyph either, it is remembered in the map
+	 * and fontconfig isn't asked again. The lookup is done in the
+	 * fallback font thread if it is running.
+	 */
+	if (f >= frclen) {
+		if (fallbackrequest(font->pattern, frcflags, rune)) {
+			rfmapput(rune, frcflags, -1, 0);
+			*glyphidx = 0;
+			return font->match;
+		}
+		if (!font->set)
+			font->set = FcFontSort(0, font->pattern, 1, 0, &fcres);
+		fontpattern = xmatchfallbackfont(font->pattern, font->set, rune);
+		fallbackcacheadd(frcflags, rune, fontpattern);
+		f = xaddfallbackfont(fontpattern, frcflags);
+		*glyphidx = XftCharIndex(xw.dpy, frc[f].font, rune);
+		stats.n[STATS_FCMATCHES]++;
+	}
+
+	rfmapput(rune, frcflags, f, *glyphidx);
+	return frc[f].font;
 }
 
 #if !DISABLE_LIGATURES
@@ -1562,11 +1928,7 @@ xmakeglyphfontspecs_ligatures(XftGlyphFontSpec *specs, const Glyph *glyphs, int
 	float runewidth = win.cw * ((glyphs[0].mode & ATTR_WIDE) ? 2.0f : 1.0f);
 	Rune rune;
 	FT_UInt glyphidx;
-	FcResult fcres;
-	FcPattern *fcpattern, *fontpattern;
-	FcFontSet *fcsets[] = { NULL };
-	FcCharSet *fccharset;
-	int f, numspecs = 0;
+	int numspecs = 0;
 	float cluster_xp, cluster_yp;
 	HbTransformData shaped;
 
@@ -1614,66 +1976,7 @@ xmakeglyphfontspecs_ligatures(XftGlyphFontSpec *specs, const Glyph *glyphs, int
 		} else {
 			/* If it's not found, try to fetch it through the font cache. */
 			rune = glyphs[idx].u;
-			for (f = 0; f < frclen; f++) {
-				glyphidx = XftCharIndex(xw.dpy, frc[f].font, rune);
-				/* Everything correct. */
-				if (glyphidx && frc[f].flags == frcflags)
-					break;
-				/* We got a default font for a not found glyph. */
-				if (!glyphidx && frc[f].flags == frcflags
-						&& frc[f].unicodep == rune) {
-					break;
-				}
-			}
-
-			/* Nothing was found. Use fontconfig to find matching font. */
-			if (f >= frclen) {
-				if (!font->set)
-					font->set = FcFontSort(0, font->pattern, 1, 0, &fcres);
-				fcsets[0] = font->set;
-
-				/*
-				 * Nothing was found in the cache. Now use
-				 * some dozen of Fontconfig calls to get the
-				 * font for one single character.
-				 *
-				 * Xft and fontconfig are design failures.
-				 */
-				fcpattern = FcPatternDuplicate(font->pattern);
-				fccharset = FcCharSetCreate();
-
-				FcCharSetAddChar(fccharset, rune);
-				FcPatternAddCharSet(fcpattern, FC_CHARSET, fccharset);
-				FcPatternAddBool(fcpattern, FC_SCALABLE, 1);
-
-				FcConfigSubstitute(0, fcpattern, FcMatchPattern);
-				FcDefaultSubstitute(fcpattern);
-
-				fontpattern = FcFontSetMatch(0, fcsets, 1, fcpattern, &fcres);
-
-				/* Allocate memory for the new cache entry. */
-				if (frclen >= frccap) {
-					frccap += 16;
-					frc = xrealloc(frc, frccap * sizeof(Fontcache));
-				}
-
-				frc[frclen].font = XftFontOpenPattern(xw.dpy, fontpattern);
-				if (!frc[frclen].font)
-					die("XftFontOpenPattern failed seeking fallback font: %s\n",
-						strerror(errno));
-				frc[frclen].flags = frcflags;
-				frc[frclen].unicodep = rune;
-
-				glyphidx = XftCharIndex(xw.dpy, frc[frclen].font, rune);
-
-				f = frclen;
-				frclen++;
-
-				FcPatternDestroy(fcpattern);
-				FcCharSetDestroy(fccharset);
-			}
-
-			specs[numspecs].font = frc[f].font;
+			specs[numspecs].font = xfallbackfont(font, frcflags, rune, &glyphidx);
 			specs[numspecs].glyph = glyphidx;
 			specs[numspecs].x = (short)xp;
 			specs[numspecs].y = (short)yp;
@@ -1694,12 +1997,8 @@ xmakeglyphfontspecs_noligatures(GlyphFontSeq *seq, XftGlyphFontSpec *specs, cons
 	float runewidth = win.cw;
 	Rune rune;
 	FT_UInt glyphidx;
-	FcResult fcres;
-	FcPattern *fcpattern, *fontpattern;
-	FcFontSet *fcsets[] = { NULL };
-	FcCharSet *fccharset;
 	Glyph new;
-	int i, f, oi = -1, numspecs = 0, numseqs = 0;
+	int i, oi = -1, numspecs = 0, numseqs = 0;
 
 	for (i = 0, xp = winx, yp = winy + font->ascent + win.cyo; i < len; ++i, ++x) {
 		/* Skip dummy wide-character spacing. */
@@ -1760,71 +2059,7 @@ xmakeglyphfontspecs_noligatures(GlyphFontSeq *seq, XftGlyphFontSpec *specs, cons
 		}
 
 		/* Fallback on font cache, search the font cache for match. */
-		for (f = 0; f < frclen; f++) {
-			glyphidx = XftCharIndex(xw.dpy, frc[f].font, rune);
-			/* Everything correct. */
-			if (glyphidx && frc[f].flags == frcflags)
-				break;
-			/* We got a default font for a not found glyph. */
-			if (!glyphidx && frc[f].flags == frcflags
-					&& frc[f].unicodep == rune) {
-				break;
-			}
-		}
-
-		/* Nothing was found. Use fontconfig to find matching font. */
-		if (f >= frclen) {
-			if (!font->set)
-				font->set = FcFontSort(0, font->pattern,
-				                       1, 0, &fcres);
-			fcsets[0] = font->set;
-
-			/*
-			 * Nothing was found in the cache. Now use
-			 * some dozen of Fontconfig calls to get the
-			 * font for one single character.
-			 *
-			 * Xft and fontconfig are design failures.
-			 */
-			fcpattern = FcPatternDuplicate(font->pattern);
-			fccharset = FcCharSetCreate();
-
-			FcCharSetAddChar(fccharset, rune);
-			FcPatternAddCharSet(fcpattern, FC_CHARSET,
-					fccharset);
-			FcPatternAddBool(fcpattern, FC_SCALABLE, 1);
-
-			FcConfigSubstitute(0, fcpattern,
-					FcMatchPattern);
-			FcDefaultSubstitute(fcpattern);
-
-			fontpattern = FcFontSetMatch(0, fcsets, 1,
-					fcpattern, &fcres);
-
-			/* Allocate memory for the new cache entry. */
-			if (frclen >= frccap) {
-				frccap += 16;
-				frc = xrealloc(frc, frccap * sizeof(Fontcache));
-			}
-
-			frc[frclen].font = XftFontOpenPattern(xw.dpy,
-					fontpattern);
-			if (!frc[frclen].font)
-				die("XftFontOpenPattern failed seeking fallback font: %s\n",
-					strerror(errno));
-			frc[frclen].flags = frcflags;
-			frc[frclen].unicodep = rune;
-
-			glyphidx = XftCharIndex(xw.dpy, frc[frclen].font, rune);
-
-			f = frclen;
-			frclen++;
-
-			FcPatternDestroy(fcpattern);
-			FcCharSetDestroy(fccharset);
-		}
-
-		specs[numspecs].font = frc[f].font;
+		specs[numspecs].font = xfallbackfont(font, frcflags, rune, &glyphidx);
 		specs[numspecs].glyph = glyphidx;
 		specs[numspecs].x = (short)xp;
 		specs[numspecs].y = (short)yp;
@@ -1872,7 +2107,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, GlyphFontSeq *seq, int y, int
 		colfg.red = TRUERED(base->fg);
 		colfg.green = TRUEGREEN(base->fg);
 		colfg.blue = TRUEBLUE(base->fg);
-		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colfg, &truefg);
+		xalloccolor(&colfg, &truefg);
 		fg = &truefg;
 	} else {
 		fg = &dc.col[base->fg];
@@ -1883,7 +2118,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, GlyphFontSeq *seq, int y, int
 		colbg.green = TRUEGREEN(base->bg);
 		colbg.red = TRUERED(base->bg);
 		colbg.blue = TRUEBLUE(base->bg);
-		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colbg, &truebg);
+		xalloccolor(&colbg, &truebg);
 		bg = &truebg;
 	} else {
 		bg = &dc.col[base->bg];
@@ -1902,8 +2137,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, GlyphFontSeq *seq, int y, int
 			colfg.green = ~fg->color.green;
 			colfg.blue = ~fg->color.blue;
 			colfg.alpha = fg->color.alpha;
-			XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colfg,
-					&revfg);
+			xalloccolor(&colfg, &revfg);
 			fg = &revfg;
 		}
 
@@ -1914,8 +2148,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, GlyphFontSeq *seq, int y, int
 			colbg.green = ~bg->color.green;
 			colbg.blue = ~bg->color.blue;
 			colbg.alpha = bg->color.alpha;
-			XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colbg,
-					&revbg);
+			xalloccolor(&colbg, &revbg);
 			bg = &revbg;
 		}
 	}
@@ -1925,7 +2158,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, GlyphFontSeq *seq, int y, int
 		colfg.green = fg->color.green / 2;
 		colfg.blue = fg->color.blue / 2;
 		colfg.alpha = fg->color.alpha;
-		XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colfg, &revfg);
+		xalloccolor(&colfg, &revfg);
 		fg = &revfg;
 	}
 
@@ -1981,7 +2214,7 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, GlyphFontSeq *seq, int y, int
 			xclear(winx, winy + win.ch, winx + width, win.h);
 
 		/* Clean up the region we want to draw to. */
-		XftDrawRect(xw.draw, bg, winx, winy, width, win.ch);
+		xfillrect(bg, winx, winy, width, win.ch);
 	}
 
 	if (dmode & DRAW_FG) {
@@ -1989,7 +2222,9 @@ xdrawglyphfontspecs(const XftGlyphFontSpec *specs, GlyphFontSeq *seq, int y, int
 			drawboxes(winx, winy, win.cw, win.ch, fg, bg, specs, seq->numspecs);
 		} else if (seq->numspecs) {
 			/* Render the glyphs. */
+			glyphcacheload(specs, seq->numspecs);
 			XftDrawGlyphFontSpec(xw.draw, fg, specs, seq->numspecs);
+			stats.n[STATS_SPECS] += seq->numspecs;
 		}
 
 		/* Render underline */
@@ -2041,7 +2276,7 @@ drawunderline(Glyph *base, Color *fg, int winx, int winy, int charlen, int lw, i
 			lcol.red = TRUERED(base->extra);
 			lcol.green = TRUEGREEN(base->extra);
 			lcol.blue = TRUEBLUE(base->extra);
-			XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &lcol, &linecolor);
+			xalloccolor(&lcol, &linecolor);
 		}
 	} else {
 		/* Foreground color for underline */
@@ -2164,12 +2399,16 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Line oline)
 	int hidden = IS_SET(MODE_HIDE) && !IS_SET(MODE_KBDSELECT);
 	int cursor = hidden ? -1 : !IS_SET(MODE_FOCUSED) ? -2 : win.cursor;
 	int cwidth = win.cw * (g.mode & ATTR_WIDE ? 2 : 1);
+	int x1, x2;
+	Line line;
 
 	/* Redraw the line where cursor was previously.
 	 * It will restore the ligatures broken by the cursor. */
 	if (oline && (term.dirty[oy] || oy != cy || ox != cx || oldcursor != cursor || blink)) {
-		xdrawline(oline, 0, oy, term.col);
-		term.dirty[oy] = 0;
+		tsetdirtspan(oy, ox, ox + 1);
+		tdirtyspan(oline, oy, &x1, &x2);
+		xdrawline(oline, x1, oy, x2);
+		xflushlines();
 	}
 	oldcursor = cursor;
 	activeurl.cursory = !hidden ? cy : -1;
@@ -2179,8 +2418,10 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Line oline)
 
 	/* Redraw the current cursor line, if it is dirty */
 	if (term.dirty[cy]) {
-		xdrawline(TLINE(cy), 0, cy, term.col);
-		term.dirty[cy] = 0;
+		line = TLINE(cy);
+		tdirtyspan(line, cy, &x1, &x2);
+		xdrawline(line, x1, cy, x2);
+		xflushlines();
 	}
 
 	/*
@@ -2220,7 +2461,7 @@ xdrawcursor(int cx, int cy, Glyph g, int ox, int oy, Line oline)
 					colbg.red = TRUERED(tmpcol);
 					colbg.green = TRUEGREEN(tmpcol);
 					colbg.blue = TRUEBLUE(tmpcol);
-					XftColorAllocValue(xw.dpy, xw.vis, xw.cmap, &colbg, &drawcol);
+					xalloccolor(&colbg, &drawcol);
 				} else
 					drawcol = dc.col[tmpcol];
 			}
@@ -2377,22 +2618,13 @@ xstartdraw(void)
 }
 
 #if !DISABLE_LIGATURES
-void
+int
 xdrawline_ligatures(Line line, int x1, int y1, int x2)
 {
 	int i, j, x, ox, numspecs, begin, end;
 	Glyph new;
-	GlyphFontSeq *seq = xw.specseq;
-	XftGlyphFontSpec *specs = xw.specbuf;
-	XRectangle r = {
-		.x = borderpx,
-		.y = borderpx + y1 * win.ch,
-		.width = win.cw * term.col,
-		.height = win.ch
-	};
-
-	/* Draw line in 2 passes: background and foreground. This way wide glyphs
-	   won't get truncated (#223) */
+	GlyphFontSeq *seq = linebatch.seq + linebatch.nseq;
+	XftGlyphFontSpec *specs = linebatch.specs + linebatch.nspecs;
 
 	/* background */
 	i = j = ox = 0;
@@ -2432,74 +2664,146 @@ xdrawline_ligatures(Line line, int x1, int y1, int x2)
 		xdrawglyphfontspecs(specs, &seq[j], y1, DRAW_BG);
 		j++;
 	}
-
-	/* Set the clipping region for text */
-	XftDrawSetClipRectangles(xw.draw, 0, 0, &r, 1);
-
-	/* foreground */
-	specs = xw.specbuf;
-	for (i = 0; i < j; i++) {
-		if (seq[i].numspecs || (seq[i].base.mode & (ATTR_UNDERLINE|ATTR_STRUCK|ATTR_HYPERLINK)))
-			xdrawglyphfontspecs(specs, &seq[i], y1, DRAW_FG);
-		specs += seq[i].numspecs;
-	}
-
-	/* Reset the clipping region */
-	XftDrawSetClip(xw.draw, 0);
+	return j;
 }
 #endif
 
-void
+int
 xdrawline_noligatures(Line line, int x1, int y1, int x2)
 {
 	int i, numseqs;
-	GlyphFontSeq *seq = xw.specseq;
-	XftGlyphFontSpec *specs = xw.specbuf;
-	XRectangle r = {
-		.x = borderpx,
-		.y = borderpx + y1 * win.ch,
-		.width = win.cw * term.col,
-		.height = win.ch
-	};
+	GlyphFontSeq *seq = linebatch.seq + linebatch.nseq;
+	XftGlyphFontSpec *specs = linebatch.specs + linebatch.nspecs;
 
 	numseqs = xmakeglyphfontspecs_noligatures(seq, specs, &line[x1], x2 - x1, x1, y1);
 
-	/* Draw line in 2 passes: background and foreground. This way wide glyphs
-	   won't get truncated (#223) */
-
 	/* background */
 	for (i = 0; i < numseqs; i++) {
 		xdrawglyphfontspecs(specs, &seq[i], y1, DRAW_BG);
 		specs += seq[i].numspecs;
 	}
-
-	/* Set the clipping region for text */
-	XftDrawSetClipRectangles(xw.draw, 0, 0, &r, 1);
-
-	/* foreground */
-	specs = xw.specbuf;
-	for (i = 0; i < numseqs; i++) {
-		if (seq[i].numspecs || (seq[i].base.mode & (ATTR_UNDERLINE|ATTR_STRUCK|ATTR_HYPERLINK)))
-			xdrawglyphfontspecs(specs, &seq[i], y1, DRAW_FG);
-		specs += seq[i].numspecs;
-	}
-
-	/* Reset the clipping region */
-	XftDrawSetClip(xw.draw, 0);
+	return numseqs;
 }
 
+/*
+ * Draws the background of the line and queues the text. The lines are
+ * drawn in 2 passes: the backgrounds of all the lines and then the text,
+ * so that wide glyphs won't get truncated (#223) and the backgrounds of
+ * the frame are filled with a few requests. xflushlines() must be called
+ * before anything else is drawn.
+ */
 void
 xdrawline(Line line, int x1, int y1, int x2)
 {
+	BatchLine *l;
+	int i, len = x2 - x1;
+
+	#if !DISABLE_LIGATURES
+	len *= 4;
+	#endif
+	if (linebatch.nlines >= linebatch.linescap) {
+		linebatch.linescap = MAX(2 * linebatch.linescap, 64);
+		linebatch.lines = xrealloc(linebatch.lines, linebatch.linescap * sizeof(BatchLine));
+	}
+	if (linebatch.nseq + x2 - x1 > linebatch.seqcap) {
+		linebatch.seqcap = MAX(2 * linebatch.seqcap, linebatch.nseq + x2 - x1);
+		linebatch.seq = xrealloc(linebatch.seq, linebatch.seqcap * sizeof(GlyphFontSeq));
+	}
+	if (linebatch.nspecs + len > linebatch.specscap) {
+		linebatch.specscap = MAX(2 * linebatch.specscap, linebatch.nspecs + len);
+		linebatch.specs = xrealloc(linebatch.specs, linebatch.specscap * sizeof(GlyphFontSpec));
+	}
+
+	l = &linebatch.lines[linebatch.nlines++];
+	l->x1 = x1;
+	l->y = y1;
+	l->x2 = x2;
+	l->seq = linebatch.nseq;
+	l->specs = linebatch.nspecs;
+
 	#if !DISABLE_LIGATURES
 	if (ligatures)
-		xdrawline_ligatures(line, x1, y1, x2);
+		l->numseqs = xdrawline_ligatures(line, x1, y1, x2);
 	else
 	#endif
-		xdrawline_noligatures(line, x1, y1, x2);
+		l->numseqs = xdrawline_noligatures(line, x1, y1, x2);
 
+	for (i = 0; i < l->numseqs; i++)
+		linebatch.nspecs += linebatch.seq[linebatch.nseq++].numspecs;
 	term.dirtyimg[y1] = 1;
-	kbds_drawstatusbar(y1);
+}
+
+/* fills the backgrounds of the queued lines and draws their text */
+void
+xflushlines(void)
+{
+	BatchLine *l, *lines = linebatch.lines;
+	GlyphFontSeq *seq;
+	XftGlyphFontSpec *specs;
+	FillBatch *b;
+	XRectangle r;
+	Picture pict;
+	int i, nlines = linebatch.nlines;
+
+	if (!nlines)
+		return;
+	linebatch.nlines = 0;
+
+	pict = XftDrawPicture(xw.draw);
+	for (b = fills; b < fills + fillslen; b++) {
+		if (pict) {
+			XRenderFillRectangles(xw.dpy, PictOpSrc, pict, &b->color.color,
+			                      b->rects, b->len);
+			stats.n[STATS_FILLS]++;
+			continue;
+		}
+		for (i = 0; i < b->len; i++) {
+			XftDrawRect(xw.draw, &b->color, b->rects[i].x, b->rects[i].y,
+			            b->rects[i].width, b->rects[i].height);
+		}
+	}
+	fillslen = 0;
+
+	for (l = lines; l < lines + nlines; l++) {
+		/* Set the clipping region for text */
+		r.x = borderpx + l->x1 * win.cw;
+		r.y = borderpx + l->y * win.ch;
+		r.width = win.cw * (l->x2 - l->x1);
+		r.height = win.ch;
+		XftDrawSetClipRectangles(xw.draw, 0, 0, &r, 1);
+
+		/* foreground */
+		specs = linebatch.specs + l->specs;
+		for (seq = linebatch.seq + l->seq; seq < linebatch.seq + l->seq + l->numseqs; seq++) {
+			if (seq->numspecs || (seq->base.mode & (ATTR_UNDERLINE|ATTR_STRUCK|ATTR_HYPERLINK)))
+				xdrawglyphfontspecs(specs, seq, l->y, DRAW_FG);
+			specs += seq->numspecs;
+		}
+
+		/* Reset the clipping region */
+		XftDrawSetClip(xw.draw, 0);
+		kbds_drawstatusbar(l->y);
+	}
+	linebatch.nseq = linebatch.nspecs = 0;
+}
+
+/*
+ * moves the lines top to bot up by n lines, or down if n is negative, in
+ * the back buffer. Returns 0 if the lines must be redrawn instead.
+ */
+int
+xscroll(int top, int bot, int n)
+{
+	int src = top + MAX(n, 0), dst = top + MAX(-n, 0);
+
+	/* the url underline, the hint and the status bar don't move with the lines */
+	if (IS_SET(MODE_KBDSELECT) || activeurl.y1 <= activeurl.y2 || activeurl.hlink >= 0)
+		return 0;
+
+	XCopyArea(xw.dpy, xw.buf, xw.buf, dc.gc, borderpx, borderpx + src * win.ch,
+	          win.cw * term.col, win.ch * (bot - top + 1 - abs(n)),
+	          borderpx, borderpx + dst * win.ch);
+	return 1;
 }
 
 void
@@ -2542,6 +2846,7 @@ xfinishdraw(void)
 		if (!im->pixmap) {
 			if (!(im->pixmap = (void *)XCreatePixmap(xw.dpy, xw.win, width, height, xw.depth)))
 				continue;
+			stats.n[STATS_SIXELS]++;
 			if (win.cw == im->cw && win.ch == im->ch) {
 				XImage ximage = {
 					.format = ZPixmap,
@@ -2557,7 +2862,7 @@ xfinishdraw(void)
 					.bitmap_pad = 32,
 					.depth = xw.depth
 				};
-				XPutImage(xw.dpy, (Drawable)im->pixmap, dc.gc, &ximage, 0, 0, 0, 0, width, height);
+				xputimage((Drawable)im->pixmap, dc.gc, &ximage, width, height);
 				if (im->transparent)
 					im->clipmask = (void *)sixel_create_clipmask((char *)im->pixels, width, height);
 			} else {
@@ -2587,7 +2892,7 @@ xfinishdraw(void)
 					.bitmap_pad = 32,
 					.depth = xw.depth
 				};
-				XPutImage(xw.dpy, (Drawable)im->pixmap, dc.gc, &ximage, 0, 0, 0, 0, width, height);
+				xputimage((Drawable)im->pixmap, dc.gc, &ximage, width, height);
 				if (im->transparent)
 					im->clipmask = (void *)sixel_create_clipmask((char *)imlib_image_get_data_for_reading_only(), width, height);
 				imlib_free_image_and_decache();
@@ -2646,15 +2951,19 @@ xfinishdraw(void)
 	}
 
 	drawscrollbackindicator();
+	drawstats();
 
 	XCopyArea(xw.dpy, xw.buf, xw.win, dc.gc, 0, 0, win.w, win.h, 0, 0);
 	XSetForeground(xw.dpy, dc.gc, dc.col[IS_SET(MODE_REVERSE) ? defaultfg : defaultbg].pixel);
+
+	/* the fallback fonts of the frame can be closed from now on */
+	frcframe++;
 }
 
 void
 drawscrollbackindicator(void)
 {
-	int barw, barh, barx, bary;
+	int barw, barh, barx, bary, y1, y2;
 	Color *barcol = &dc.col[scrollbackindicatorfg];
 	Color *bordercol = &dc.col[defaultbg];
 
@@ -2669,6 +2978,12 @@ drawscrollbackindicator(void)
 	bary -= bary * term.scr / term.histf - borderpx;
 	XftDrawRect(xw.draw, bordercol, barx-1, bary-1, barw+2, barh+2);
 	XftDrawRect(xw.draw, barcol, barx, bary, barw, barh);
+
+	/* the bar is erased by redrawing the last column */
+	y1 = MAX((bary - 1 - borderpx) / win.ch, 0);
+	y2 = MIN((bary + barh - borderpx) / win.ch, term.row - 1);
+	for (; y1 <= y2; y1++)
+		tsetdirtspan(y1, term.col - 1, term.col);
 }
 
 void
@@ -2993,9 +3308,10 @@ run(void)
 	int rev, w = win.w, h = win.h;
 	fd_set rfd;
 	int xfd = XConnectionNumber(xw.dpy), ttyfd, maxfd, xev, drawing;
-	struct timespec seltv, *tv, now, trigger;
-	struct timespec lastscroll, lastblink, cursorlastblink;
-	double timeout, cursortimeout, scrolltimeout, vbelltimeout;
+	int resizing = 0;
+	struct timespec seltv, *tv, now, trigger = {0};
+	struct timespec lastscroll, lastblink, cursorlastblink, lastresize;
+	double timeout, cursortimeout, scrolltimeout, vbelltimeout, reflowtimeleft;
 
 	/* Waiting for window mapping */
 	do {
@@ -3021,6 +3337,9 @@ run(void)
 	cursorlastblink = (struct timespec){0};
 
 	for (timeout = -1, drawing = 0;;) {
+		if (statsrequested)
+			dumpstats();
+
 		FD_ZERO(&rfd);
 		FD_SET(xfd, &rfd);
 		maxfd = xfd;
@@ -3029,6 +3348,10 @@ run(void)
 			FD_SET(ttyfd, &rfd);
 			maxfd = MAX(xfd, ttyfd);
 		}
+		if (fallback.fd[0] >= 0) {
+			FD_SET(fallback.fd[0], &rfd);
+			maxfd = MAX(maxfd, fallback.fd[0]);
+		}
 
 		if (XPending(xw.dpy) || ttyread_pending())
 			timeout = 0;  /* existing events might not set xfd */
@@ -3049,8 +3372,25 @@ run(void)
 		clock_gettime(CLOCK_MONOTONIC, &now);
 
 		int ttyin = FD_ISSET(ttyfd, &rfd) || ttyread_pending();
-		if (ttyin)
-			ttyread();
+		if (ttyin) {
+			/* the first byte starts the frame, so that the draining
+			 * does not delay it past maxlatency */
+			if (!drawing) {
+				trigger = now;
+				win.mode &= ~MODE_CURSORBLINK;
+				cursorlastblink = now;
+				drawing = 1;
+			}
+			/* drain the tty until the next frame is due */
+			statsstart(STATS_READ);
+			ttyread(maxlatency - TIMEDIFF(now, trigger));
+			statsstop(STATS_READ);
+			clock_gettime(CLOCK_MONOTONIC, &now);
+		}
+
+		/* redraw the characters whose fallback fonts were found */
+		if (fallback.fd[0] >= 0 && FD_ISSET(fallback.fd[0], &rfd) && fallbackresults())
+			ttyin = 1;
 
 		xev = 0, w = win.w, h = win.h;
 		while (XPending(xw.dpy)) {
@@ -3066,8 +3406,15 @@ run(void)
 				(handler[ev.type])(&ev);
 			}
 		}
-		if (w != win.w || h != win.h)
+		if (w != win.w || h != win.h) {
+			/* reflow the history when the size has settled */
+			if (reflowtimeout) {
+				tdeferreflow(1);
+				resizing = 1;
+				lastresize = now;
+			}
 			cresize(w, h);
+		}
 
 		/*
 		 * To reduce flicker and tearing, when new content or event
@@ -3129,6 +3476,15 @@ run(void)
 			}
 			timeout = (timeout >= 0) ? MIN(timeout, cursortimeout) : cursortimeout;
 		}
+		if (resizing) {
+			reflowtimeleft = reflowtimeout - TIMEDIFF(now, lastresize);
+			if (reflowtimeleft <= 0) {
+				tdeferreflow(0);
+				resizing = 0;
+			} else {
+				timeout = (timeout >= 0) ? MIN(timeout, reflowtimeleft) : reflowtimeleft;
+			}
+		}
 		if (asr.isscrolling) {
 			scrolltimeout = asr.timeout - TIMEDIFF(now, lastscroll);
 			if (scrolltimeout <= 0) {
@@ -3155,7 +3511,10 @@ run(void)
 		}
 
 		draw();
+		statsstart(STATS_FLUSH);
 		XFlush(xw.dpy);
+		statsstop(STATS_FLUSH);
+		statsframe();
 		drawing = 0;
 		activeurl.draw = 0;
 
@@ -3271,6 +3630,7 @@ run:
 	setlocale(LC_CTYPE, "");
 	XSetLocaleModifiers("");
 	signal(SIGUSR1, sigusr1_reload);
+	signal(SIGUSR2, sigusr2_stats);
 	if (!(xw.dpy = XOpenDisplay(NULL)))
 		die("Can't open display\n");
 